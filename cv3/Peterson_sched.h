@@ -7,6 +7,7 @@
 //
 // The race on SMP systems is NOT solved, i.e. it fails on SMP systems.
 // Selhání na systémech SMP NENÍ zabráněno, tj. program selhává na systémech SMP.
+// SMP-correct versions for N threads: filter_lock.h, bakery_lock.h
 
 #include <stdbool.h>
 #include <sched.h>		// sched_yield(2)
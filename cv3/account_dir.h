@@ -0,0 +1,309 @@
+// Operating Systems: sample code
+// Threads
+// Account directory: a hash table with lock-free lookups (RCU style)
+//
+// The directory maps account ids to accounts. It is a chained hash table published
+// through one pointer. The readers look up accounts without any lock and without
+// writing anything shared: inside an epoch section (epoch_reclaim.h) they load the
+// table pointer and follow the chain. The writers are serialized by a mutex and never
+// change a node a reader may be following, except for the one link which makes a
+// change visible:
+//   insert   a new node is filled first, then linked at the head of its chain
+//   retire   the node is unlinked by one store to its predecessor, the node and the
+//            account are freed after a grace period
+//   resize   a table twice the size is built from copies of the nodes and published
+//            by one store to the table pointer, the old table and its nodes are freed
+//            after a grace period; the accounts are not copied and stay where they are
+// A reader sees the directory before or after each change, never in between.
+//
+// The accounts themselves (the balances) are not protected by the directory.
+//
+// usage:
+//
+// #define _GNU_SOURCE		// posix_memalign(3)
+// #include "account_dir.h"
+//
+// account_dir_t dir;
+//
+// dir_init(&dir, buckets, readers);
+// dir_insert(&dir, id, balance);		// the writers
+// dir_retire(&dir, id);
+// dir_read_begin(&dir, reader);		// reader 0 to readers - 1
+// account = dir_lookup(&dir, id);		// valid until dir_read_end()
+// dir_read_end(&dir, reader);
+// dir_destroy(&dir);
+
+#ifndef ACCOUNT_DIR_H
+#define ACCOUNT_DIR_H
+
+#include <stdbool.h>
+#include <stdlib.h>			// malloc(3), calloc(3)
+#include <errno.h>
+#include <pthread.h>
+#include "epoch_reclaim.h"		// epoch-based reclamation
+
+// the average chain length over which the table is resized
+#ifndef DIR_LOAD_FACTOR
+#	define DIR_LOAD_FACTOR	2
+#endif
+
+// an account
+typedef struct {
+	long id;
+	volatile long balance;
+} account_t;
+
+// a node of a chain: immutable once linked, except for next
+typedef struct dir_node {
+	long id;
+	account_t *account;
+	struct dir_node *volatile next;
+} dir_node_t;
+
+// a table of chains
+typedef struct {
+	unsigned long mask;		// buckets - 1
+	dir_node_t *volatile buckets[];
+} dir_table_t;
+
+// directory data
+typedef struct {
+	dir_table_t *volatile table;	// the published table
+	pthread_mutex_t writer;		// serializes the writers
+	ebr_t ebr;			// the readers' epochs, the retired nodes
+	long count;			// accounts in the directory
+	long resizes;			// statistics: tables replaced
+} account_dir_t;
+
+// initialize an empty directory, buckets a power of two, return 0 or an error number
+static inline
+int dir_init(account_dir_t *d, unsigned long buckets, int readers);
+
+// free the directory with all its accounts, no reader or writer may be active
+static inline
+void dir_destroy(account_dir_t *d);
+
+// add a new account, return 0, EEXIST or ENOMEM
+static inline
+int dir_insert(account_dir_t *d, long id, long balance);
+
+// remove the account, return 0 or ENOENT
+static inline
+int dir_retire(account_dir_t *d, long id);
+
+// enter a read-side section of the reader
+__attribute__ ((always_inline)) static inline
+void dir_read_begin(account_dir_t *d, int reader);
+
+// find the account, NULL if none, only in a read-side section
+__attribute__ ((always_inline)) static inline
+account_t *dir_lookup(account_dir_t *d, long id);
+
+// leave the read-side section, the accounts found may be freed from now on
+__attribute__ ((always_inline)) static inline
+void dir_read_end(account_dir_t *d, int reader);
+
+
+// the bucket of the id: multiplicative hashing, the high bits are the best mixed
+static inline
+unsigned long dir_hash(const dir_table_t *t, long id)
+{
+	return ((unsigned long) id * 0x9E3779B97F4A7C15UL >> 20) & t->mask;
+}
+
+// a new table with empty chains
+static inline
+dir_table_t *dir_table_new(unsigned long buckets)
+{
+	dir_table_t *t;
+
+	if ((t = calloc(1, sizeof(dir_table_t) + buckets * sizeof(dir_node_t *))))
+		t->mask = buckets - 1;
+	return t;
+}
+
+// free the table and the nodes of its chains (not the accounts), for ebr_retire()
+static inline
+void dir_table_free(void *arg)
+{
+	dir_table_t *t = arg;
+	dir_node_t *n, *next;
+	unsigned long b;
+
+	for (b = 0; b <= t->mask; ++b)
+		for (n = t->buckets[b]; n; n = next) {
+			next = n->next;
+			free(n);
+		}
+	free(t);
+}
+
+// free the node and its account, for ebr_retire()
+static inline
+void dir_node_free(void *arg)
+{
+	dir_node_t *n = arg;
+
+	free(n->account);
+	free(n);
+}
+
+// initialize
+int dir_init(account_dir_t *d, unsigned long buckets, int readers)
+{
+	int rc;
+
+	if (!buckets || buckets & (buckets - 1))
+		return EINVAL;
+	if ((rc = ebr_init(&d->ebr, readers)))
+		return rc;
+	if (!(d->table = dir_table_new(buckets))) {
+		ebr_destroy(&d->ebr);
+		return ENOMEM;
+	}
+	if ((rc = pthread_mutex_init(&d->writer, NULL))) {
+		free(d->table);
+		ebr_destroy(&d->ebr);
+		return rc;
+	}
+	d->count = 0;
+	d->resizes = 0;
+	return 0;
+}
+
+// free everything
+void dir_destroy(account_dir_t *d)
+{
+	dir_node_t *n;
+	unsigned long b;
+
+	ebr_destroy(&d->ebr);
+	for (b = 0; b <= d->table->mask; ++b)
+		for (n = d->table->buckets[b]; n; n = n->next)
+			free(n->account);
+	dir_table_free(d->table);
+	d->table = NULL;
+	pthread_mutex_destroy(&d->writer);
+}
+
+// the node of the id in the chain, NULL if none
+static inline
+dir_node_t *dir_find(dir_table_t *t, long id)
+{
+	dir_node_t *n;
+
+	for (n = __atomic_load_n(&t->buckets[dir_hash(t, id)], __ATOMIC_ACQUIRE); n;
+	     n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE))
+		if (n->id == id)
+			return n;
+	return NULL;
+}
+
+// replace the table by one twice the size, under the writer mutex
+static inline
+int dir_resize(account_dir_t *d)
+{
+	dir_table_t *old = d->table, *t;
+	dir_node_t *n, *copy;
+	unsigned long b, h;
+
+	if (!(t = dir_table_new((old->mask + 1) * 2)))
+		return ENOMEM;
+	// the old nodes are being read: the new table gets copies
+	for (b = 0; b <= old->mask; ++b)
+		for (n = old->buckets[b]; n; n = n->next) {
+			if (!(copy = malloc(sizeof(dir_node_t)))) {
+				dir_table_free(t);
+				return ENOMEM;
+			}
+			copy->id = n->id;
+			copy->account = n->account;
+			h = dir_hash(t, n->id);
+			copy->next = t->buckets[h];
+			t->buckets[h] = copy;
+		}
+	// publish the complete table, the readers of the old one finish there
+	__atomic_store_n(&d->table, t, __ATOMIC_RELEASE);
+	ebr_retire(&d->ebr, old, dir_table_free);
+	++d->resizes;
+	return 0;
+}
+
+// insert
+int dir_insert(account_dir_t *d, long id, long balance)
+{
+	dir_table_t *t;
+	dir_node_t *n;
+	unsigned long h;
+	int rc = 0;
+
+	pthread_mutex_lock(&d->writer);
+	if (dir_find(d->table, id)) {
+		pthread_mutex_unlock(&d->writer);
+		return EEXIST;
+	}
+	// a resize failing for lack of memory leaves longer chains, not an error
+	if (d->count >= DIR_LOAD_FACTOR * (long) (d->table->mask + 1))
+		dir_resize(d);
+	t = d->table;
+	if (!(n = malloc(sizeof(dir_node_t))) || !(n->account = malloc(sizeof(account_t)))) {
+		free(n);
+		rc = ENOMEM;
+	} else {
+		// the node is complete before it is linked
+		n->id = id;
+		n->account->id = id;
+		n->account->balance = balance;
+		h = dir_hash(t, id);
+		n->next = t->buckets[h];
+		__atomic_store_n(&t->buckets[h], n, __ATOMIC_RELEASE);
+		++d->count;
+	}
+	pthread_mutex_unlock(&d->writer);
+	return rc;
+}
+
+// retire
+int dir_retire(account_dir_t *d, long id)
+{
+	dir_table_t *t;
+	dir_node_t *volatile *link;
+	dir_node_t *n;
+
+	pthread_mutex_lock(&d->writer);
+	t = d->table;
+	for (link = &t->buckets[dir_hash(t, id)]; (n = *link) && n->id != id; link = &n->next)
+		;
+	if (!n) {
+		pthread_mutex_unlock(&d->writer);
+		return ENOENT;
+	}
+	// unlink: a reader at the node still finds its next, the node stays valid for it
+	__atomic_store_n(link, n->next, __ATOMIC_RELEASE);
+	--d->count;
+	ebr_retire(&d->ebr, n, dir_node_free);
+	pthread_mutex_unlock(&d->writer);
+	return 0;
+}
+
+// enter
+void dir_read_begin(account_dir_t *d, int reader)
+{
+	ebr_enter(&d->ebr, reader);
+}
+
+// look up
+account_t *dir_lookup(account_dir_t *d, long id)
+{
+	dir_node_t *n = dir_find(__atomic_load_n(&d->table, __ATOMIC_ACQUIRE), id);
+
+	return n ? n->account : NULL;
+}
+
+// leave
+void dir_read_end(account_dir_t *d, int reader)
+{
+	ebr_exit(&d->ebr, reader);
+}
+
+#endif // ACCOUNT_DIR_H
@@ -0,0 +1,121 @@
+// Operating Systems: sample code
+// Critical Sections
+// SW method: Lamport's bakery algorithm for N threads
+//
+// A thread takes a number greater than all the numbers it sees and waits until
+// every thread with a smaller (number, id) pair has left. The threads enter in
+// the order of their numbers (FIFO up to the ties broken by the id).
+//
+// It is correct on SMP only if the stores are visible before the following loads:
+// the number and the choosing flag are written with sequentially consistent stores
+// (xchg on x86, a full barrier) and all the others' state is read the same way.
+// Entering costs O(n) reads even without contention.
+//
+// usage:
+//
+// #include "bakery_lock.h"
+//
+// bakery_init(n);		// threads 0 to n - 1, n <= BAKERY_MAX_THREADS
+//
+// bakery_wait(self);
+// // critical section
+// bakery_post(self);
+
+#ifndef BAKERY_LOCK_H
+#define BAKERY_LOCK_H
+
+#include <stdbool.h>
+#include <sched.h>			// sched_yield(2)
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// the maximal number of threads
+#ifndef BAKERY_MAX_THREADS
+#	define BAKERY_MAX_THREADS	(1<<6)
+#endif
+
+// spins before the CPU is given up
+#ifndef BAKERY_SPIN_LIMIT
+#	define BAKERY_SPIN_LIMIT	(1<<7)
+#endif
+
+// the state of one thread, on its own cache line
+typedef struct {
+	volatile bool choosing;		// taking a number just now
+	volatile unsigned long number;	// 0: access to the critical section NOT needed
+} __attribute__ ((aligned(64))) bakery_slot_t;
+
+// bakery data
+// static variables are always initialized to 0 (C standard)
+static bakery_slot_t bakery[BAKERY_MAX_THREADS];
+static int bakery_threads;
+
+// bakery init
+__attribute__ ((always_inline)) static inline
+void bakery_init(int n);
+
+// bakery wait: enter the critical section
+__attribute__ ((always_inline)) static inline
+void bakery_wait(int self);
+
+// bakery signal: leave the critical section
+__attribute__ ((always_inline)) static inline
+void bakery_post(int self);
+
+
+// bakery init
+void bakery_init(int n)
+{
+	int i;
+
+	bakery_threads = n;
+	for (i = 0; i < BAKERY_MAX_THREADS; ++i) {
+		bakery[i].choosing = false;
+		bakery[i].number = 0;
+	}
+}
+
+// spin-wait step: pause, give up the CPU now and then
+static inline
+void bakery_spin(unsigned int *spins)
+{
+	if (++*spins % BAKERY_SPIN_LIMIT)
+		cpu_relax();
+	else
+		sched_yield();		// the thread we wait for may not be running
+}
+
+// bakery wait
+void bakery_wait(int self)
+{
+	unsigned long number = 0, other;
+	unsigned int spins = 0;
+	int k;
+
+	// take a number greater than all the others
+	__atomic_store_n(&bakery[self].choosing, true, __ATOMIC_SEQ_CST);
+	for (k = 0; k < bakery_threads; ++k)
+		if ((other = __atomic_load_n(&bakery[k].number, __ATOMIC_SEQ_CST)) > number)
+			number = other;
+	__atomic_store_n(&bakery[self].number, number + 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&bakery[self].choosing, false, __ATOMIC_SEQ_CST);
+	++number;
+
+	// wait for all the threads with a smaller number (or the same one and a smaller id)
+	for (k = 0; k < bakery_threads; ++k) {
+		if (k == self)
+			continue;
+		while (__atomic_load_n(&bakery[k].choosing, __ATOMIC_SEQ_CST))
+			bakery_spin(&spins);
+		while ((other = __atomic_load_n(&bakery[k].number, __ATOMIC_SEQ_CST))
+		       && (other < number || (other == number && k < self)))
+			bakery_spin(&spins);
+	}
+}
+
+// bakery signal
+void bakery_post(int self)
+{
+	__atomic_store_n(&bakery[self].number, 0, __ATOMIC_RELEASE);	// leave the critical section
+}
+
+#endif // BAKERY_LOCK_H
@@ -0,0 +1,453 @@
+// Operating Systems: sample code
+// Threads
+// Critical Sections
+// Bank request dispatcher: producers and tellers connected by a lock-free queue
+//
+// The producers (the front end) generate withdrawal requests and put them into one
+// bounded multi-producer multi-consumer queue (mpmc_queue.h); the tellers take the
+// requests out, apply them to the shared balance under a futex lock and return each
+// completed request to the reply queue of its producer. A producer has at most window
+// requests outstanding, then it waits for a reply before issuing the next request;
+// the request objects are reused, nothing is allocated while running.
+//
+// The end-to-end latency of a request (issue to reply) and the time it spent in the
+// queue are recorded in histograms. The main thread samples the queue depth every
+// sample interval while the producers run: a queue filling up means the tellers
+// cannot keep up and the latency grows with the depth (Little's law).
+//
+// usage: bank_dispatch [-p producers] [-t tellers] [-Q capacity] [-w window] [-b balance]
+//                      [-n requests] [-m max_withdraw] [-s seed] [-S sample_us] [-v] [-q]
+//
+// Results are printed as "key=value" records, one record per line:
+//   config ...     the parameters of the run
+//   depth ...      the queue depth at each sample
+//   producer ...   per-producer request counts
+//   teller ...     per-teller request counts
+//   result ...     totals, throughput, the balance check, depth and latency percentiles
+
+#define _GNU_SOURCE               // syscall(2), posix_memalign(3)
+
+#include <stdio.h>
+#include <stdlib.h>            // strtol(3), strtoull(3)
+#include <string.h>            // memset(3)
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>            // getpid(), getopt(3)
+#include <time.h>              // time(2), clock_gettime(2), nanosleep(2)
+#include <pthread.h>
+#include "futex_lock.h"          // spin-then-park lock, Linux futex(2)
+#include "rng.h"          // per-thread xorshift64* generator
+#include "spin_barrier.h"          // synchronous start
+#include "latency_hist.h"          // latency histograms, TSC timestamps
+#include "mpmc_queue.h"          // bounded lock-free MPMC queue
+#include "bench_opts.h"          // option parsing, elapsed time
+
+#define PRODUCERS    (1<<1)        // default number of producer threads
+#define TELLERS        (1<<2)        // default number of teller threads
+#define CAPACITY    (1<<10)        // default request queue capacity
+#define WINDOW        (1<<4)        // default outstanding requests per producer
+#define INITIAL_BALANCE    (1<<20)        // default initial balance
+#define MAX_WITHDRAW    (1<<6)        // default maximum amount per request
+#define SAMPLE_US    (1000)        // default queue depth sampling interval
+
+#define CACHE_LINE    64            // cache line size, used to avoid false sharing
+
+struct producer;
+
+// one withdrawal request, returned to its producer with the result
+typedef struct {
+    struct producer *from;        // the producer to reply to
+    int amount;                // the amount to withdraw
+    bool accepted;            // the result, set by the teller
+    uint64_t issued;            // TSC: put into the queue by the producer
+    uint64_t taken;            // TSC: taken out of the queue by a teller
+} __attribute__((aligned(CACHE_LINE))) request_t;
+
+// per-producer data, each producer on its own cache line
+typedef struct producer {
+    int id;                // producer number
+    pthread_t tid;            // thread ID
+    mpmc_queue_t replies;        // the completed requests of this producer
+    request_t *requests;        // window request objects, reused
+    long issued;            // requests put into the queue
+    long accepted;            // requests completed with the money withdrawn
+    long rejected;            // requests rejected for insufficient balance
+    long withdrawn;            // the amount withdrawn for this producer
+    hist_t *latency;            // issue to reply
+    struct timespec start;        // the time the producer started
+    struct timespec end;        // the time the last reply came
+} __attribute__((aligned(CACHE_LINE))) producer_t;
+
+// per-teller data, each teller on its own cache line
+typedef struct {
+    int id;                // teller number
+    pthread_t tid;            // thread ID
+    long executed;            // requests applied to the balance
+    long accepted;            // of them with the money withdrawn
+    hist_t *queued;            // issue to taken out of the queue
+} __attribute__((aligned(CACHE_LINE))) teller_t;
+
+// run parameters
+int n_producers = PRODUCERS;
+int n_tellers = TELLERS;
+long capacity = CAPACITY;
+long window = WINDOW;
+long initial_balance = INITIAL_BALANCE;
+long requests = 0;            // requests per producer, 0: balance / producers
+int max_withdraw = MAX_WITHDRAW;
+unsigned long long seed;        // RNG seed, each producer has its own stream
+long sample_us = SAMPLE_US;
+
+int verbose = 1;            // verbosity
+
+volatile long balance;            // shared balance
+futex_lock_t lock = FUTEX_LOCK_INITIALIZER;    // guards the balance
+mpmc_queue_t queue;            // the requests, from all producers to all tellers
+volatile int producers_done = 0;    // producers with all replies received
+
+producer_t *producers = NULL;        // the array of per-producer data
+teller_t *tellers = NULL;        // the array of per-teller data
+
+barrier_t barrier;            // synchronous start
+bool barrier_initialized = false;
+
+// release allocated resources
+void release_all(void) {
+    int i;
+
+    if (barrier_initialized && (errno = barrier_destroy(&barrier)))
+        perror("barrier_destroy");
+    barrier_initialized = false;
+    mpmc_destroy(&queue);
+    if (producers)
+        for (i = 0; i < n_producers; ++i) {
+            mpmc_destroy(&producers[i].replies);
+            free(producers[i].requests);
+            free(producers[i].latency);
+        }
+    free(producers);
+    producers = NULL;
+    if (tellers)
+        for (i = 0; i < n_tellers; ++i)
+            free(tellers[i].queued);
+    free(tellers);
+    tellers = NULL;
+}
+
+// synchronize all threads (the main thread included, its id is producers + tellers)
+static void sync_threads(int id) {
+    int rc;
+
+    if ((rc = barrier_wait(&barrier, id)) && rc != BARRIER_SERIAL_THREAD) {
+        errno = rc;
+        perror("barrier_wait");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// account the completed request to its producer
+static inline void complete(producer_t *self, request_t *r) {
+    hist_record(self->latency, tsc_read() - r->issued);
+    if (r->accepted) {
+        ++self->accepted;
+        self->withdrawn += r->amount;
+    } else
+        ++self->rejected;
+}
+
+// a producer: issue the requests, at most window outstanding, and collect the replies
+void *do_produce(void *arg) {
+    producer_t *self = arg;
+    request_t *r;
+    rng_t rng;
+    long free_requests = window;    // request objects never issued yet
+    long outstanding = 0;
+
+    rng_seed(&rng, seed, self->id);
+    sync_threads(self->id);    // synchronize threads start
+    clock_gettime(CLOCK_MONOTONIC, &self->start);
+
+    for (self->issued = 0; self->issued < requests; ++self->issued) {
+        // an unused request object, or the next reply
+        if (free_requests)
+            r = &self->requests[--free_requests];
+        else {
+            r = mpmc_pop(&self->replies);
+            complete(self, r);
+            --outstanding;
+        }
+        r->from = self;
+        r->amount = 1 + rng_below(&rng, max_withdraw);
+        r->issued = tsc_read();
+        mpmc_push(&queue, r);
+        ++outstanding;
+    }
+    // the replies to the last window
+    for (; outstanding; --outstanding)
+        complete(self, mpmc_pop(&self->replies));
+
+    clock_gettime(CLOCK_MONOTONIC, &self->end);
+    __atomic_fetch_add(&producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// a teller: apply the requests to the balance until a NULL request comes
+void *do_serve(void *arg) {
+    teller_t *self = arg;
+    request_t *r;
+
+    sync_threads(n_producers + self->id);    // synchronize threads start
+
+    while ((r = mpmc_pop(&queue))) {
+        r->taken = tsc_read();
+        hist_record(self->queued, r->taken - r->issued);
+
+        futex_lock(&lock);
+        // critical section
+        if ((r->accepted = balance >= r->amount))
+            balance -= r->amount;
+        futex_unlock(&lock);
+
+        ++self->executed;
+        self->accepted += r->accepted;
+        // the reply queue holds the whole window: never full for long
+        mpmc_push(&r->from->replies, r);
+    }
+    return NULL;
+}
+
+// print usage and exit
+static void usage(const char *prog, int status) {
+    fprintf(status ? stderr : stdout,
+            "usage: %s [-p producers] [-t tellers] [-Q capacity] [-w window] [-b balance]\n"
+            "          [-n requests] [-m max_withdraw] [-s seed] [-S sample_us] [-v] [-q]\n"
+            "  -p producers     the number of producer threads (default: %d)\n"
+            "  -t tellers       the number of teller threads (default: %d)\n"
+            "  -Q capacity      request queue capacity, rounded up to a power of two (default: %d)\n"
+            "  -w window        outstanding requests per producer (default: %d)\n"
+            "  -b balance       initial balance (default: %d)\n"
+            "  -n requests      requests per producer (default: balance / producers)\n"
+            "  -m max_withdraw  maximum amount per request (default: %d)\n"
+            "  -s seed          RNG seed, the same seed gives the same requests (default: random)\n"
+            "  -S sample_us     queue depth sampling interval in microseconds (default: %d)\n"
+            "  -v               increase verbosity\n"
+            "  -q               print the result record only\n",
+            prog, PRODUCERS, TELLERS, CAPACITY, WINDOW, INITIAL_BALANCE, MAX_WITHDRAW, SAMPLE_US);
+    exit(status);
+}
+
+// the smallest power of two not below n
+static long power_of_two(long n) {
+    long p = 1;
+
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int i;
+    long total_issued = 0, total_accepted = 0, total_rejected = 0, total_withdrawn = 0;
+    long samples = 0, depth, depth_sum = 0, depth_max = 0;
+    const struct timespec *start, *end;
+    struct timespec sampling, now, pause;
+    double elapsed, ns_per_tick;
+    bool seeded = false;
+    hist_t *latency, *queued;
+
+    // options
+    while ((opt = getopt(argc, argv, "p:t:Q:w:b:n:m:s:S:vqh")) != -1) {
+        switch (opt) {
+            case 'p':
+                n_producers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 't':
+                n_tellers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'Q':
+                capacity = power_of_two(parse_positive(argv[0], opt, optarg));
+                break;
+            case 'w':
+                window = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'b':
+                initial_balance = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'n':
+                requests = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'm':
+                max_withdraw = parse_positive(argv[0], opt, optarg);
+                break;
+            case 's':
+                seed = parse_seed(argv[0], opt, optarg);
+                seeded = true;
+                break;
+            case 'S':
+                sample_us = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'v':
+                ++verbose;
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+            default:
+                usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (!requests)
+        requests = initial_balance / n_producers;
+
+    // initialization
+    atexit(release_all);      // release resources at process exit
+
+    balance = initial_balance;
+    if (posix_memalign((void **) &producers, CACHE_LINE, n_producers * sizeof(producer_t))
+        || posix_memalign((void **) &tellers, CACHE_LINE, n_tellers * sizeof(teller_t))) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    memset(producers, 0, n_producers * sizeof(producer_t));
+    memset(tellers, 0, n_tellers * sizeof(teller_t));
+    if ((errno = mpmc_init(&queue, capacity))) {
+        perror("mpmc_init");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n_producers; ++i) {
+        producers[i].id = i;
+        if ((errno = mpmc_init(&producers[i].replies, power_of_two(window)))) {
+            perror("mpmc_init");
+            exit(EXIT_FAILURE);
+        }
+        if (posix_memalign((void **) &producers[i].requests, CACHE_LINE, window * sizeof(request_t))
+            || !(producers[i].latency = malloc(sizeof(hist_t)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        hist_init(producers[i].latency);
+    }
+    for (i = 0; i < n_tellers; ++i) {
+        tellers[i].id = i;
+        if (!(tellers[i].queued = malloc(sizeof(hist_t)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        hist_init(tellers[i].queued);
+    }
+    ns_per_tick = tsc_ns_per_tick();    // calibrated before the measurement
+
+    // initialize barrier with threshold producers + tellers + 1 (the main thread included)
+    if ((errno = barrier_init(&barrier, BARRIER_PTHREAD, n_producers + n_tellers + 1))) {
+        perror("barrier_init");
+        exit(EXIT_FAILURE);
+    }
+    barrier_initialized = true;
+
+    if (!seeded)
+        seed = getpid() * time(NULL);    // RNG init
+
+    // report the parameters
+    if (verbose)
+        printf("config producers=%d tellers=%d capacity=%ld window=%ld balance=%ld requests=%ld"
+               " max_withdraw=%d seed=%llu sample_us=%ld\n",
+               n_producers, n_tellers, capacity, window, initial_balance, requests, max_withdraw, seed,
+               sample_us);
+
+    // create threads
+    for (i = 0; i < n_producers; ++i)
+        if (pthread_create(&producers[i].tid, NULL, do_produce, &producers[i])) {
+            fprintf(stderr, "ERROR creating producer %d\n", i);
+            return EXIT_FAILURE;
+        }
+    for (i = 0; i < n_tellers; ++i)
+        if (pthread_create(&tellers[i].tid, NULL, do_serve, &tellers[i])) {
+            fprintf(stderr, "ERROR creating teller %d\n", i);
+            return EXIT_FAILURE;
+        }
+
+    sync_threads(n_producers + n_tellers);    // start the threads / odstartuj vlákna
+
+    // sample the queue depth until the producers have all their replies
+    clock_gettime(CLOCK_MONOTONIC, &sampling);
+    pause.tv_sec = sample_us / 1000000;
+    pause.tv_nsec = sample_us % 1000000 * 1000;
+    while (__atomic_load_n(&producers_done, __ATOMIC_ACQUIRE) < n_producers) {
+        nanosleep(&pause, NULL);
+        depth = mpmc_size(&queue);
+        ++samples;
+        depth_sum += depth;
+        if (depth > depth_max)
+            depth_max = depth;
+        if (verbose) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            printf("depth t_ms=%.3f depth=%ld\n", elapsed_seconds(&sampling, &now) * 1e3, depth);
+        }
+    }
+
+    // stop the tellers: one NULL request each
+    for (i = 0; i < n_tellers; ++i)
+        mpmc_push(&queue, NULL);
+
+    // wait for the threads termination
+    for (i = 0; i < n_producers; ++i)
+        if (pthread_join(producers[i].tid, NULL)) {
+            fprintf(stderr, "ERROR joining producer %d\n", i);
+            return EXIT_FAILURE;
+        }
+    for (i = 0; i < n_tellers; ++i)
+        if (pthread_join(tellers[i].tid, NULL)) {
+            fprintf(stderr, "ERROR joining teller %d\n", i);
+            return EXIT_FAILURE;
+        }
+
+    // sum up the totals, measure from the first producer start to the last reply
+    latency = producers[0].latency;
+    queued = tellers[0].queued;
+    start = &producers[0].start;
+    end = &producers[0].end;
+    for (i = 0; i < n_producers; ++i) {
+        if (elapsed_seconds(&producers[i].start, start) > 0)
+            start = &producers[i].start;
+        if (elapsed_seconds(end, &producers[i].end) > 0)
+            end = &producers[i].end;
+        total_issued += producers[i].issued;
+        total_accepted += producers[i].accepted;
+        total_rejected += producers[i].rejected;
+        total_withdrawn += producers[i].withdrawn;
+        if (i)
+            hist_merge(latency, producers[i].latency);
+        if (verbose)
+            printf("producer id=%d issued=%ld accepted=%ld rejected=%ld withdrawn=%ld\n", i,
+                   producers[i].issued, producers[i].accepted, producers[i].rejected, producers[i].withdrawn);
+    }
+    for (i = 0; i < n_tellers; ++i) {
+        if (i)
+            hist_merge(queued, tellers[i].queued);
+        if (verbose)
+            printf("teller id=%d executed=%ld accepted=%ld\n", i, tellers[i].executed, tellers[i].accepted);
+    }
+    elapsed = elapsed_seconds(start, end);
+
+    printf("result producers=%d tellers=%d capacity=%ld window=%ld elapsed_s=%.6f requests=%ld accepted=%ld"
+           " rejected=%ld throughput=%.0f ns_per_op=%.2f balance=%ld withdrawn=%ld lost=%ld"
+           " depth_samples=%ld depth_mean=%.1f depth_max=%ld",
+           n_producers, n_tellers, capacity, window, elapsed, total_issued, total_accepted, total_rejected,
+           elapsed > 0 ? total_issued / elapsed : 0.0, total_issued ? elapsed * 1e9 / total_issued : 0.0,
+           balance, total_withdrawn, initial_balance - total_withdrawn - balance,
+           samples, samples ? (double) depth_sum / samples : 0.0, depth_max);
+    hist_print("latency", latency, ns_per_tick);
+    hist_print("queued", queued, ns_per_tick);
+    printf("\n");
+
+    // check the result and report
+    if (balance + total_withdrawn != initial_balance || balance < 0)
+        fprintf(stderr, "INCONSISTENT BALANCE!\n"
+                        "initial - withdrawn != final balance (%ld != %ld)\n",
+                initial_balance - total_withdrawn, balance);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,651 @@
+// Operating Systems: sample code
+// Threads
+// Critical Sections
+// Bank transfer benchmark: many accounts, lock striping
+//
+// The bank has an array of accounts, each thread makes random operations on them:
+// transfers between two accounts and, with a workload mix (-w), deposits, withdrawals
+// and balance inquiries too. The accounts may be skewed (-z, Zipfian: hot accounts)
+// and the amounts distributed uniformly, exponentially or fixed (-d); see workload.h.
+// The streams of operations are generated before the start; they can be written
+// to a file (-o) and replayed exactly (-i). An account is guarded by the lock of its stripe; the accounts sharing
+// a cache line are in the same stripe, so the stripes do not share cache lines
+// (false sharing) and consecutive lines go round robin to the stripes.
+// A transfer locks both stripes in the order of their numbers, so two transfers
+// in the opposite directions cannot deadlock. With one stripe it is a global lock;
+// with more stripes the unrelated transfers do not wait for each other.
+// The money is never created or lost: the sum of all accounts must be the initial
+// one plus the deposits minus the withdrawals (conservation check) and no account
+// may go below zero.
+//
+// usage: bank_transfer [-l lock] [-t threads] [-A accounts] [-S stripes] [-b balance]
+//                      [-n transactions] [-m max_amount] [-s seed] [-a affinity]
+//                      [-w mix] [-z theta] [-d distribution] [-o file | -i file] [-v] [-q]
+//
+// Results are printed as "key=value" records, one record per line:
+//   config ...   the parameters of the run
+//   thread ...   per-thread operation counts
+//   result ...   totals, throughput, ns per operation and the conservation check
+
+#ifndef _GNU_SOURCE
+#       define _GNU_SOURCE        // enable barriers, posix_memalign(3), CPU_SET(3)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>            // strtol(3), strtoull(3)
+#include <string.h>            // strcmp(3)
+#include <unistd.h>            // getpid(), getopt(3)
+#include <time.h>              // time(2), clock_gettime(2)
+#include <pthread.h>
+#include <errno.h>
+#include <stdbool.h>            // bool, true, false
+#include "ttas_lock.h"          // test-and-test-and-set with exponential backoff
+#include "ticket_lock.h"          // FIFO ticket lock
+#include "futex_lock.h"          // spin-then-park lock, Linux futex(2)
+#include "rng.h"          // per-thread xorshift64* generator
+#include "spin_barrier.h"          // synchronous start
+#include "cpu_topology.h"          // CPU topology from /sys, thread pinning
+#include "workload.h"          // operation mix, Zipfian accounts, stream files
+#include "bench_opts.h"          // option parsing, elapsed time
+
+#define THREADS        (1<<2)        // default number of concurrent threads
+#define ACCOUNTS    (1<<16)        // default number of accounts
+#define STRIPES        (1<<6)        // default number of lock stripes
+#define INITIAL_AMOUNT    (1<<10)        // default initial balance of an account
+#define TRANSACTIONS    (1<<18)        // default transfers per thread
+#define MAX_AMOUNT    (1<<6)        // default maximum amount per operation
+
+#define CACHE_LINE    64            // cache line size, used to avoid false sharing
+#define LINE_ACCOUNTS    (CACHE_LINE / sizeof(long))    // accounts in one cache line
+
+// stripe lock types
+typedef enum {
+    STRIPE_FUTEX,            // futex mutex: adaptive spinning, then sleeping in the kernel
+    STRIPE_TICKET,            // ticket lock (fetch-and-add), FIFO
+    STRIPE_TTAS,            // test-and-test-and-set, pause and exponential backoff
+    STRIPE_LOCKS            // the number of lock types
+} stripe_lock_t;
+
+static const char *stripe_lock_names[STRIPE_LOCKS] = {
+    [STRIPE_FUTEX]  = "futex",
+    [STRIPE_TICKET] = "ticket",
+    [STRIPE_TTAS]   = "ttas",
+};
+
+// one lock per stripe, each on its own cache line
+typedef struct {
+    union {
+        futex_lock_t futex;
+        ticket_lock_t ticket;
+        volatile bool ttas;
+    };
+} __attribute__((aligned(CACHE_LINE))) stripe_t;
+
+// per-thread data, each thread on its own cache line
+typedef struct {
+    int id;                // thread number
+    pthread_t tid;            // thread ID
+    long ops[OP_TYPES];            // operations performed, by type
+    long rejected;            // withdrawals and transfers rejected for insufficient balance
+    long single;            // transfers within one stripe (one lock)
+    long moved;                // the amount transferred by this thread
+    long deposited;            // the amount deposited by this thread
+    long withdrawn;            // the amount withdrawn by this thread
+    long inquired;            // the sum of the balances seen by the inquiries
+    workload_op_t *stream;        // the operations of this thread, generated before the start
+    struct timespec start;        // the time the thread started its transfers
+    struct timespec end;        // the time the thread finished its transfers
+    int pinned;                // the CPU the thread is pinned to, -1: not pinned
+} __attribute__((aligned(CACHE_LINE))) teller_t;
+
+// run parameters
+stripe_lock_t lock_type = STRIPE_FUTEX;
+int threads = THREADS;
+long n_accounts = ACCOUNTS;
+long n_stripes = STRIPES;
+long initial_amount = INITIAL_AMOUNT;
+long max_transactions = TRANSACTIONS;
+workload_t workload = WORKLOAD_DEFAULTS;    // mix, skew and amounts, transfers only by default
+unsigned long long seed;        // RNG seed, each thread has its own stream
+affinity_t affinity = AFFINITY_NONE;    // thread placement policy
+cpu_topology_t topology;        // usable CPUs
+int cpu_order[CPU_MAX];            // the CPUs in the order of the policy, thread i gets i % cpu_count
+int cpu_count = 0;
+
+int verbose = 1;            // verbosity
+
+long *accounts = NULL;            // the balances, shared
+stripe_t *stripes = NULL;        // the locks of the account stripes
+teller_t *tellers = NULL;        // the array of per-thread data
+
+barrier_t barrier;            // synchronous start
+bool barrier_initialized = false;
+
+// release allocated resources
+void release_all(void) {
+    int i;
+
+    if (barrier_initialized && (errno = barrier_destroy(&barrier)))
+        perror("barrier_destroy");
+    barrier_initialized = false;
+    free(accounts);
+    accounts = NULL;
+    free(stripes);
+    stripes = NULL;
+    if (tellers)
+        for (i = 0; i < threads; ++i)
+            free(tellers[i].stream);
+    free(tellers);
+    tellers = NULL;
+}
+
+// synchronize all threads (the main thread included, its id is threads)
+static void sync_threads(int id) {
+    int rc;
+
+    if ((rc = barrier_wait(&barrier, id)) && rc != BARRIER_SERIAL_THREAD) {
+        errno = rc;
+        perror("barrier_wait");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// lock the stripe
+static inline void stripe_lock(stripe_t *s) {
+    switch (lock_type) {
+        case STRIPE_TICKET:
+            ticket_lock(&s->ticket);
+            break;
+        case STRIPE_TTAS:
+            ttas_lock(&s->ttas);
+            break;
+        default:
+            futex_lock(&s->futex);
+            break;
+    }
+}
+
+// unlock the stripe
+static inline void stripe_unlock(stripe_t *s) {
+    switch (lock_type) {
+        case STRIPE_TICKET:
+            ticket_unlock(&s->ticket);
+            break;
+        case STRIPE_TTAS:
+            ttas_unlock(&s->ttas);
+            break;
+        default:
+            futex_unlock(&s->futex);
+            break;
+    }
+}
+
+// the stripe of the account: whole cache lines round robin
+static inline long stripe_of(long account) {
+    return account / LINE_ACCOUNTS % n_stripes;
+}
+
+// move the amount between two different accounts, return false if rejected
+static inline bool transfer(teller_t *self, long from, long to, int amount) {
+    long s1 = stripe_of(from), s2 = stripe_of(to);
+    bool accepted;
+
+    // deadlock avoidance: the stripes are always locked in the ascending order
+    if (s1 > s2) {
+        long s = s1;
+
+        s1 = s2;
+        s2 = s;
+    }
+    stripe_lock(&stripes[s1]);
+    if (s1 != s2)
+        stripe_lock(&stripes[s2]);
+    else
+        ++self->single;
+    // critical section - start
+    if (accounts[from] < amount) {    // if not enough: reject transfer
+        accepted = false;
+    } else {
+        accounts[from] -= amount;
+        accounts[to] += amount;
+        accepted = true;
+    }
+    // critical section - end
+    if (s1 != s2)
+        stripe_unlock(&stripes[s2]);
+    stripe_unlock(&stripes[s1]);
+
+    return accepted;
+}
+
+// deposit the amount to the account
+static inline void deposit(long account, int amount) {
+    stripe_t *s = &stripes[stripe_of(account)];
+
+    stripe_lock(s);
+    accounts[account] += amount;    // critical section
+    stripe_unlock(s);
+}
+
+// withdraw the amount from the account, return false if rejected
+static inline bool withdraw(long account, int amount) {
+    stripe_t *s = &stripes[stripe_of(account)];
+    bool accepted;
+
+    stripe_lock(s);
+    // critical section - start
+    if (accounts[account] < amount) {    // if not enough: reject withdrawal
+        accepted = false;
+    } else {
+        accounts[account] -= amount;
+        accepted = true;
+    }
+    // critical section - end
+    stripe_unlock(s);
+
+    return accepted;
+}
+
+// read the balance of the account
+static inline long inquiry(long account) {
+    stripe_t *s = &stripes[stripe_of(account)];
+    long value;
+
+    stripe_lock(s);
+    value = accounts[account];    // critical section
+    stripe_unlock(s);
+
+    return value;
+}
+
+void *do_transfers(void *arg) {
+    teller_t *self = arg;
+    const workload_op_t *op;
+    long i;
+
+    sync_threads(self->id);        // synchronize threads start / synchronizace startu vláken
+    clock_gettime(CLOCK_MONOTONIC, &self->start);
+
+    for (i = 0; i < max_transactions; ++i) {
+        op = &self->stream[i];
+        switch (op->type) {
+            case OP_DEPOSIT:
+                deposit(op->account, op->amount);
+                self->deposited += op->amount;
+                break;
+            case OP_WITHDRAW:
+                if (withdraw(op->account, op->amount))
+                    self->withdrawn += op->amount;
+                else
+                    ++self->rejected;
+                break;
+            case OP_INQUIRY:
+                self->inquired += inquiry(op->account);
+                break;
+            default:
+                if (transfer(self, op->account, op->to, op->amount))
+                    self->moved += op->amount;
+                else
+                    ++self->rejected;
+                break;
+        }
+        ++self->ops[op->type];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &self->end);
+    return NULL;
+}
+
+// print usage and exit
+static void usage(const char *prog, int status) {
+    fprintf(status ? stderr : stdout,
+            "usage: %s [-l lock] [-t threads] [-A accounts] [-S stripes] [-b balance]\n"
+            "          [-n transactions] [-m max_amount] [-s seed] [-a affinity]\n"
+            "          [-w mix] [-z theta] [-d distribution] [-o file | -i file] [-v] [-q]\n"
+            "  -l lock          stripe lock: futex, ticket, ttas (default: futex)\n"
+            "  -t threads       the number of concurrent threads (default: %d)\n"
+            "  -A accounts      the number of accounts (default: %d)\n"
+            "  -S stripes       the number of lock stripes, 1: one global lock (default: %d)\n"
+            "  -b balance       initial balance of each account (default: %d)\n"
+            "  -n transactions  operations per thread (default: %d)\n"
+            "  -m max_amount    maximum amount per operation (default: %d)\n"
+            "  -s seed          RNG seed, the same seed gives the same operations (default: random)\n"
+            "  -a affinity      pin the threads: compact, scatter, smt or a CPU list like 0,2,4-7 (default: none)\n"
+            "  -w mix           percentages deposit:withdraw:inquiry:transfer (default: 0:0:0:100)\n"
+            "  -z theta         Zipfian account skew, 0 <= theta < 1 (default: 0, uniform)\n"
+            "  -d distribution  amounts: uniform, exp, fixed (default: uniform)\n"
+            "  -o file          write the generated operations to the file\n"
+            "  -i file          replay the operations from the file (sets threads, transactions, accounts)\n"
+            "  -v               increase verbosity\n"
+            "  -q               print the result record only\n",
+            prog, THREADS, ACCOUNTS, STRIPES, INITIAL_AMOUNT, TRANSACTIONS, MAX_AMOUNT);
+    exit(status);
+}
+
+// find the stripe lock by its name, exit on error
+static stripe_lock_t parse_lock(const char *prog, const char *name) {
+    int l;
+
+    for (l = 0; l < STRIPE_LOCKS; ++l)
+        if (!strcmp(name, stripe_lock_names[l]))
+            return l;
+    fprintf(stderr, "%s: unknown lock: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return STRIPE_LOCKS;    // not reached
+}
+
+// parse a Zipfian skew option argument, exit on error
+static double parse_theta(const char *prog, int opt, const char *arg) {
+    char *end;
+    double value;
+
+    errno = 0;
+    value = strtod(arg, &end);
+    if (errno || end == arg || *end || value < 0 || value >= 1) {
+        fprintf(stderr, "%s: invalid argument of -%c: %s\n", prog, opt, arg);
+        usage(prog, EXIT_FAILURE);
+    }
+    return value;
+}
+
+// find the amount distribution by its name, exit on error
+static amount_dist_t parse_dist(const char *prog, const char *name) {
+    int d;
+
+    for (d = 0; d < AMOUNT_DISTS; ++d)
+        if (!strcmp(name, amount_dist_names[d]))
+            return d;
+    fprintf(stderr, "%s: unknown distribution: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return AMOUNT_DISTS;    // not reached
+}
+
+// set the placement policy by its name or read the list of CPUs, exit on error
+static void parse_affinity(const char *prog, const char *arg) {
+    int a;
+    int i;
+
+    topo_read(&topology);
+    for (a = 0; a < AFFINITY_POLICIES; ++a)
+        if (a != AFFINITY_LIST && !strcmp(arg, affinity_names[a])) {
+            affinity = a;
+            cpu_count = topo_order(&topology, affinity, cpu_order);
+            return;
+        }
+    affinity = AFFINITY_LIST;
+    if ((cpu_count = topo_parse_list(arg, cpu_order, CPU_MAX)) <= 0) {
+        fprintf(stderr, "%s: invalid affinity: %s\n", prog, arg);
+        usage(prog, EXIT_FAILURE);
+    }
+    for (i = 0; i < cpu_count; ++i)
+        if (!topo_find(&topology, cpu_order[i])) {
+            fprintf(stderr, "%s: CPU %d is not available\n", prog, cpu_order[i]);
+            exit(EXIT_FAILURE);
+        }
+}
+
+// generate the operations of all threads, or read them from the open stream file, exit on error
+static void prepare_streams(const char *prog, FILE *in, const char *out) {
+    workload_op_t **streams;
+    FILE *f;
+    rng_t rng;
+    long i;
+    int t;
+
+    // the array of the streams for workload_read() and workload_write()
+    if (!(streams = malloc(threads * sizeof(workload_op_t *)))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (t = 0; t < threads; ++t)
+        if (!(streams[t] = tellers[t].stream = malloc(max_transactions * sizeof(workload_op_t)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+
+    if (in) {
+        if (workload_read(in, streams, threads, max_transactions, n_accounts)) {
+            fprintf(stderr, "%s: invalid operation in the stream file\n", prog);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        for (t = 0; t < threads; ++t) {
+            rng_seed(&rng, seed, t);    // RNG init: the same seed gives the same stream
+            for (i = 0; i < max_transactions; ++i)
+                workload_next(&workload, &rng, &streams[t][i]);
+        }
+    }
+
+    if (out) {
+        if (!(f = fopen(out, "w"))) {
+            perror(out);
+            exit(EXIT_FAILURE);
+        }
+        if (workload_write(f, streams, threads, max_transactions, n_accounts) | fclose(f)) {
+            perror(out);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(streams);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    long i;
+    int t;
+    long total_ops[OP_TYPES] = { 0 };
+    long total = 0, total_rejected = 0, total_single = 0, total_moved = 0;
+    long total_deposited = 0, total_withdrawn = 0;
+    long sum = 0, negative = 0, expected;
+    const struct timespec *start, *end;
+    double elapsed;
+    bool seeded = false;
+    pthread_attr_t attr;
+    const char *in = NULL, *out = NULL;    // stream files
+    FILE *in_file = NULL;
+
+    // options
+    while ((opt = getopt(argc, argv, "l:t:A:S:b:n:m:s:a:w:z:d:o:i:vqh")) != -1) {
+        switch (opt) {
+            case 'l':
+                lock_type = parse_lock(argv[0], optarg);
+                break;
+            case 't':
+                threads = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'A':
+                n_accounts = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'S':
+                n_stripes = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'b':
+                initial_amount = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'n':
+                max_transactions = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'm':
+                workload.max_amount = parse_positive(argv[0], opt, optarg);
+                break;
+            case 's':
+                seed = parse_seed(argv[0], opt, optarg);
+                seeded = true;
+                break;
+            case 'a':
+                parse_affinity(argv[0], optarg);
+                break;
+            case 'w':
+                if (workload_parse_mix(optarg, workload.mix)) {
+                    fprintf(stderr, "%s: invalid mix, 4 percentages adding up to 100 expected: %s\n", argv[0], optarg);
+                    usage(argv[0], EXIT_FAILURE);
+                }
+                break;
+            case 'z':
+                workload.theta = parse_theta(argv[0], opt, optarg);
+                break;
+            case 'd':
+                workload.dist = parse_dist(argv[0], optarg);
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            case 'i':
+                in = optarg;
+                break;
+            case 'v':
+                ++verbose;
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+            default:
+                usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (in && out) {
+        fprintf(stderr, "%s: -i and -o are mutually exclusive\n", argv[0]);
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    // a replayed run has the shape of the recorded one
+    if (in) {
+        if (!(in_file = fopen(in, "r"))) {
+            perror(in);
+            exit(EXIT_FAILURE);
+        }
+        if (workload_read_header(in_file, &threads, &max_transactions, &n_accounts)) {
+            fprintf(stderr, "%s: %s: not a stream file\n", argv[0], in);
+            exit(EXIT_FAILURE);
+        }
+    }
+    workload.accounts = n_accounts;
+    if (workload_init(&workload)) {
+        fprintf(stderr, "%s: a transfer needs at least 2 accounts, at most %d\n", argv[0], INT_MAX);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (n_stripes > (n_accounts + LINE_ACCOUNTS - 1) / LINE_ACCOUNTS)
+        n_stripes = (n_accounts + LINE_ACCOUNTS - 1) / LINE_ACCOUNTS;    // more stripes would never be used
+
+    // initialization
+    atexit(release_all);      // release resources at process exit
+
+    if (posix_memalign((void **) &accounts, CACHE_LINE, n_accounts * sizeof(long))
+        || posix_memalign((void **) &stripes, CACHE_LINE, n_stripes * sizeof(stripe_t))
+        || posix_memalign((void **) &tellers, CACHE_LINE, threads * sizeof(teller_t))) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n_accounts; ++i)
+        accounts[i] = initial_amount;
+    memset(stripes, 0, n_stripes * sizeof(stripe_t));    // all lock types are unlocked when zero
+    memset(tellers, 0, threads * sizeof(teller_t));
+
+    // initialize barrier with threshold threads + 1 (the main thread included)
+    if ((errno = barrier_init(&barrier, BARRIER_PTHREAD, threads + 1))) {
+        perror("barrier_init");
+        exit(EXIT_FAILURE);
+    }
+    barrier_initialized = true;
+
+    if (!seeded)
+        seed = getpid() * time(NULL);    // RNG init
+
+    // report the parameters
+    if (verbose)
+        printf("config lock=%s threads=%d accounts=%ld stripes=%ld balance=%ld transactions=%ld max_amount=%d"
+               " seed=%llu affinity=%s mix=%d:%d:%d:%d theta=%.3f amounts=%s replay=%s\n",
+               stripe_lock_names[lock_type], threads, n_accounts, n_stripes, initial_amount, max_transactions,
+               workload.max_amount, seed, affinity_names[affinity],
+               workload.mix[OP_DEPOSIT], workload.mix[OP_WITHDRAW], workload.mix[OP_INQUIRY],
+               workload.mix[OP_TRANSFER], workload.theta, amount_dist_names[workload.dist], in ? in : "no");
+
+    // the operations, before the measurement
+    prepare_streams(argv[0], in_file, out);
+    if (in_file)
+        fclose(in_file);
+
+    // create threads, pinned to their CPUs if requested
+    if ((errno = pthread_attr_init(&attr))) {
+        perror("pthread_attr_init");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < threads; ++i) {
+        tellers[i].id = i;
+        tellers[i].pinned = affinity != AFFINITY_NONE ? cpu_order[i % cpu_count] : -1;
+        if (tellers[i].pinned >= 0 && (errno = topo_attr_pin(&attr, tellers[i].pinned))) {
+            perror("pthread_attr_setaffinity_np");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&tellers[i].tid, &attr, do_transfers, &tellers[i])) {
+            fprintf(stderr, "ERROR creating thread %ld\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    sync_threads(threads);    // start the threads / odstartuj vlákna
+
+    // wait for the threads termination
+    for (i = 0; i < threads; ++i) {
+        if (pthread_join(tellers[i].tid, NULL)) {
+            fprintf(stderr, "ERROR joining thread %ld\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // sum up the totals of each thread, measure from the first start to the last finish
+    start = &tellers[0].start;
+    end = &tellers[0].end;
+    for (i = 0; i < threads; ++i) {
+        if (elapsed_seconds(&tellers[i].start, start) > 0)
+            start = &tellers[i].start;
+        if (elapsed_seconds(end, &tellers[i].end) > 0)
+            end = &tellers[i].end;
+        for (t = 0; t < OP_TYPES; ++t) {
+            total_ops[t] += tellers[i].ops[t];
+            total += tellers[i].ops[t];
+        }
+        total_rejected += tellers[i].rejected;
+        total_single += tellers[i].single;
+        total_moved += tellers[i].moved;
+        total_deposited += tellers[i].deposited;
+        total_withdrawn += tellers[i].withdrawn;
+        if (verbose) {
+            printf("thread id=%ld", i);
+            for (t = 0; t < OP_TYPES; ++t)
+                printf(" %s=%ld", op_names[t], tellers[i].ops[t]);
+            printf(" rejected=%ld single_stripe=%ld moved=%ld deposited=%ld withdrawn=%ld cpu=%d\n",
+                   tellers[i].rejected, tellers[i].single, tellers[i].moved, tellers[i].deposited,
+                   tellers[i].withdrawn, tellers[i].pinned);
+        }
+    }
+    elapsed = elapsed_seconds(start, end);
+
+    // conservation: the transfers only move the money, deposits and withdrawals change the total
+    for (i = 0; i < n_accounts; ++i) {
+        sum += accounts[i];
+        if (accounts[i] < 0)
+            ++negative;
+    }
+    expected = n_accounts * initial_amount + total_deposited - total_withdrawn;
+
+    printf("result lock=%s threads=%d accounts=%ld stripes=%ld elapsed_s=%.6f ops=%ld",
+           stripe_lock_names[lock_type], threads, n_accounts, n_stripes, elapsed, total);
+    for (t = 0; t < OP_TYPES; ++t)
+        printf(" %s=%ld", op_names[t], total_ops[t]);
+    printf(" rejected=%ld throughput=%.0f ns_per_op=%.2f single_stripe=%ld moved=%ld deposited=%ld withdrawn=%ld"
+           " total=%ld lost=%ld negative=%ld\n",
+           total_rejected, elapsed > 0 ? total / elapsed : 0.0, total ? elapsed * 1e9 / total : 0.0,
+           total_single, total_moved, total_deposited, total_withdrawn, sum, expected - sum, negative);
+
+    // check the result and report
+    if (sum != expected || negative)
+        fprintf(stderr, "CONSERVATION VIOLATED!\n"
+                        "initial + deposited - withdrawn != final total (%ld != %ld), negative accounts: %ld\n",
+                expected, sum, negative);
+
+    return EXIT_SUCCESS;
+}
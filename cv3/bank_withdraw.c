@@ -0,0 +1,1577 @@
+// Operating Systems: sample code
+// Threads
+// Critical Sections
+// Bank withdrawal benchmark: one program for all lock strategies
+//
+// Replaces bank_withdraw_SW1.c, bank_withdraw_SW1_sched.c, bank_withdraw_xchg.c
+// and bank_withdraw_xchg_sched.c; the strategy, the number of threads, the initial
+// balance and the number of transactions are selected at run time.
+//
+// usage: bank_withdraw [-l strategy] [-t threads] [-b balance] [-n transactions]
+//                      [-m max_withdraw] [-B batch] [-s seed] [-P] [-c] [-H]
+//                      [-Y barrier] [-W warmup] [-R rounds] [-a affinity]
+//                      [-I readers] [-r ratio] [-J journal] [-G group] [-F flush_us]
+//                      [-T workers] [-X workers] [-y] [-N nodes] [-L passes] [-v] [-q]
+//
+// The threads run warmup + rounds rounds, each started synchronously and beginning
+// with the initial balance; only the measured rounds are reported.
+//
+// Results are printed as "key=value" records, one record per line:
+//   config ...   the parameters of the run
+//   thread ...   per-thread transaction counts and withdrawn amounts (each round)
+//   reader ...   per-thread inquiry counts (each round, with -I)
+//   result ...   totals, throughput, ns per operation and the lost transactions check (each round)
+//   summary ...  throughput over all measured rounds (if more than one)
+//
+// With -a the tellers are pinned to CPUs by a placement policy (compact, scatter, smt)
+// or an explicit list of CPUs; the thread records then show the CPU, its core and
+// package, the result record the whole mapping.
+//
+// With -I the inquiry threads read the balance and the total amount taken out of it
+// while the tellers run. The pair is protected by a sequence lock: the readers do not
+// write anything shared and retry if a teller changed the pair meanwhile. Each pair
+// read is checked: the two must always add up to the initial balance. The strategies
+// without mutual exclusion (cas, shard, sw1, sw1_sched) cannot be combined with -I.
+//
+// With -J each accepted withdrawal is appended to a journal file and the teller goes on
+// only after its record is durable. The records are not written in the critical section:
+// the tellers append them to a ring and one writer thread writes them in groups of at
+// most -G records, one write(2) and one fdatasync(2) per group, waiting at most -F
+// microseconds for a group to fill. The result record shows the commits per second,
+// the group sizes and the commit latency percentiles.
+//
+// With -T the tellers are not threads but tasks run by a work-stealing pool of the
+// given number of workers, so there may be many more tellers than threads. A task
+// runs its whole round on one worker, the lock holder is never waiting in a queue.
+//
+// With -X the tellers are fibers (user-space threads with small stacks) run by the given
+// number of worker threads; with the fmutex and fsem strategies a teller waiting for
+// the lock gives its worker to another fiber instead of spinning or sleeping. With -y
+// each teller yields after each transaction (sched_yield(2) or fiber_yield()), so the
+// difference of ns_per_op shows the cost of a context switch. The result record shows
+// the stack reserved per teller and the peak resident memory of the process; the CPU
+// time and context switches of the tellers are not measured and left out of it.
+//
+// The cohort strategy passes the lock among the tellers of one NUMA node for at most
+// -L acquisitions in a row before another node may take it. The node of a teller is
+// the node of its CPU; with -N the tellers are split into that many simulated nodes
+// instead (contiguous groups of the CPUs of the placement, or of the tellers when not
+// pinned), so the lock can be tried on a machine with a single node.
+
+#ifndef _GNU_SOURCE
+#       define _GNU_SOURCE        // enable barriers, posix_memalign(3), syscall(2)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>            // strtol(3), strtoull(3)
+#include <string.h>            // strcmp(3)
+#include <sys/types.h>
+#include <sys/resource.h>            // getrusage(2)
+#include <unistd.h>            // getpid(), getopt(3)
+#include <time.h>              // time(2), clock_gettime(2)
+#include <sched.h>             // sched_yield(2)
+#include <pthread.h>
+#include <errno.h>
+#include <stdbool.h>            // bool, true, false
+#include "test_and_set_bool.h"          // test_and_set() using the xchg instruction or C11 atomics
+#include "ttas_lock.h"          // test-and-test-and-set with exponential backoff
+#include "ticket_lock.h"          // FIFO ticket lock
+#include "mcs_lock.h"          // FIFO queue lock, local spinning
+#include "cohort_lock.h"          // NUMA-aware cohort lock, ticket locks
+#include "futex_lock.h"          // spin-then-park lock, Linux futex(2)
+#include "bench_opts.h"          // option parsing, elapsed time
+#include "filter_lock.h"          // filter lock: Peterson's algorithm for N threads
+#include "bakery_lock.h"          // Lamport's bakery algorithm
+#include "seqlock.h"          // sequence lock for the balance inquiries
+#include "rng.h"          // per-thread xorshift64* generator
+#include "perf_counters.h"          // per-thread perf_event_open(2) counters
+#include "latency_hist.h"          // latency histograms, TSC timestamps
+#include "spin_barrier.h"          // reusable sense-reversing and tournament barriers
+#include "cpu_topology.h"          // CPU topology from /sys, thread pinning
+#include "journal.h"          // group-commit journal, one writer thread
+#include "thread_pool.h"          // work-stealing thread pool
+#include "fiber.h"          // fibers on worker threads, fiber mutex and semaphore
+
+#define INITIAL_AMOUNT    (1<<20)        // default initial balance
+#define THREADS        (1<<2)        // default number of concurrent threads
+#define MAX_WITHDRAW    (1<<6)        // default maximum amount per transaction
+#define JOURNAL_GROUP    (1<<6)        // default maximum records per journal write
+
+#define CACHE_LINE    64            // cache line size, used to avoid false sharing
+
+// lock strategies / strategie zamykání kritické sekce
+typedef enum {
+    LOCK_SW1,            // shared flag, empty busy waiting (NOT correct)
+    LOCK_SW1_SCHED,        // shared flag, busy waiting with sched_yield(2) (NOT correct)
+    LOCK_XCHG,            // test-and-set (xchg), empty busy waiting
+    LOCK_XCHG_SCHED,        // test-and-set (xchg), busy waiting with sched_yield(2)
+    LOCK_C11,            // test-and-set (C11 atomic_exchange, acquire / release), empty busy waiting
+    LOCK_C11_SCHED,        // test-and-set (C11 atomic_exchange), busy waiting with sched_yield(2)
+    LOCK_FILTER,            // filter lock (N-thread Peterson), loads and stores only
+    LOCK_BAKERY,            // Lamport's bakery, loads and stores only, FIFO
+    LOCK_TTAS,            // test-and-test-and-set, pause and exponential backoff
+    LOCK_TICKET,            // ticket lock (fetch-and-add), FIFO
+    LOCK_MCS,            // MCS queue lock, FIFO, each waiter spins on its own node
+    LOCK_COHORT,            // cohort lock: global and per-node ticket locks, passed within a node
+    LOCK_FUTEX,            // futex mutex: adaptive spinning, then sleeping in the kernel
+    LOCK_FMUTEX,            // fiber mutex: a waiting fiber yields its worker (-X only)
+    LOCK_FSEM,            // fiber semaphore with the initial value 1 (-X only)
+    LOCK_CAS,            // lock-free: compare-and-swap loop on the balance
+    LOCK_SHARD,            // per-thread shards of the balance, stealing when empty
+    LOCK_FC,            // flat combining: the lock holder applies all published requests
+    LOCK_STRATEGIES        // the number of strategies
+} lock_strategy_t;
+
+static const struct {
+    const char *name;
+    const char *desc;
+} strategies[LOCK_STRATEGIES] = {
+    [LOCK_SW1]        = { "sw1",        "shared flag, busy waiting (NOT correct)" },
+    [LOCK_SW1_SCHED]  = { "sw1_sched",  "shared flag, busy waiting with sched_yield (NOT correct)" },
+    [LOCK_XCHG]       = { "xchg",       "test-and-set (xchg), busy waiting" },
+    [LOCK_XCHG_SCHED] = { "xchg_sched", "test-and-set (xchg), busy waiting with sched_yield" },
+    [LOCK_C11]        = { "c11",        "test-and-set (C11 atomics, acquire / release), busy waiting" },
+    [LOCK_C11_SCHED]  = { "c11_sched",  "test-and-set (C11 atomics), busy waiting with sched_yield" },
+    [LOCK_FILTER]     = { "filter",     "filter lock (N-thread Peterson), fenced loads and stores" },
+    [LOCK_BAKERY]     = { "bakery",     "Lamport's bakery, fenced loads and stores, FIFO" },
+    [LOCK_TTAS]       = { "ttas",       "test-and-test-and-set, pause, exponential backoff" },
+    [LOCK_TICKET]     = { "ticket",     "ticket lock (fetch-and-add), FIFO" },
+    [LOCK_MCS]        = { "mcs",        "MCS queue lock, FIFO, local spinning" },
+    [LOCK_COHORT]     = { "cohort",     "cohort lock, passed within a NUMA node, then released globally" },
+    [LOCK_FUTEX]      = { "futex",      "futex mutex, adaptive spinning, then sleeping" },
+    [LOCK_FMUTEX]     = { "fmutex",     "fiber mutex, a waiting fiber gives its worker to another one (-X)" },
+    [LOCK_FSEM]       = { "fsem",       "fiber semaphore, binary, a waiting fiber gives its worker away (-X)" },
+    [LOCK_CAS]        = { "cas",        "lock-free, compare-and-swap (cmpxchg) retry loop" },
+    [LOCK_SHARD]      = { "shard",      "per-thread balance shards, stealing from others when empty" },
+    [LOCK_FC]         = { "fc",         "flat combining, the combiner applies all published requests" },
+};
+
+// per-thread data, each teller on its own cache line(s)
+typedef struct {
+    mcs_node_t node;            // MCS queue node of this thread
+    int id;                // thread number
+    pthread_t tid;            // thread ID
+    long transactions;        // transactions performed (accepted + rejected)
+    long withdrawals;        // accepted withdrawals
+    long withdrawn;            // the amount withdrawn by this thread
+    long cas_failures;            // failed compare-and-swap attempts (cas strategy)
+    long steals;            // balance taken from other shards (shard strategy)
+    bool drained;            // all shards found empty (shard), the balance gone and the reservation too small (batching)
+    long reserved;            // the balance reserved by this teller (batching)
+    long reservations;            // critical sections entered to reserve (batching)
+    long fc_passes;            // combining passes made by this thread (fc strategy)
+    long fc_applied;            // requests applied by this thread as the combiner (fc strategy)
+    rng_t rng;                // random withdrawal amounts of this thread
+    int *amounts;            // pre-generated amounts (-P), NULL: generated on the fly
+    perf_counters_t perf;        // performance counters of the transactions loop (-c)
+    hist_t *wait_hist;            // lock acquisition wait, or the whole lock-free withdrawal (-H)
+    hist_t *hold_hist;            // critical section hold time (-H)
+    hist_t *commit_hist;            // journal append to durable acknowledgement (-J)
+    struct timespec start;        // the time the thread started its transactions
+    struct timespec end;        // the time the thread finished its transactions
+    struct timespec cpu;        // CPU time consumed by the transactions
+    long nvcsw;                // voluntary context switches (blocking, sched_yield)
+    long nivcsw;            // involuntary context switches (preemption)
+    int pinned;                // the CPU the thread is pinned to, -1: not pinned
+    int last_cpu;            // the CPU the thread finished the round on
+    int cohort_node;            // the node of the teller in the cohort lock (cohort strategy)
+} __attribute__((aligned(CACHE_LINE))) teller_t;
+
+// per-thread data of an inquiry thread, written by the thread only
+typedef struct {
+    int id;                // reader number
+    pthread_t tid;            // thread ID
+    long inquiries;            // consistent snapshots read
+    long retries;            // snapshots read again because a writer interfered
+    long inconsistent;            // snapshots not adding up to the initial balance
+    struct timespec start;        // the time the thread started its inquiries
+    struct timespec end;        // the time the thread finished its inquiries
+    int pinned;                // the CPU the thread is pinned to, -1: not pinned
+} __attribute__((aligned(CACHE_LINE))) reader_t;
+
+// run parameters
+lock_strategy_t strategy = LOCK_XCHG;
+int threads = THREADS;
+long initial_amount = INITIAL_AMOUNT;
+long max_transactions = 0;        // per thread, 0: initial_amount / threads
+int max_withdraw = MAX_WITHDRAW;
+int batch = 1;                // withdrawals served from one reservation, 1: no batching
+unsigned long long seed;        // RNG seed, each thread has its own stream
+bool pregenerate = false;        // generate all amounts before the start
+bool counters = false;            // measure performance counters
+bool histograms = false;        // record latency histograms
+int warmup = 0;                // rounds before the measurement
+int rounds = 1;                // measured rounds
+int readers = 0;            // inquiry threads
+long ratio = 0;                // inquiries per reader for each teller transaction, 0: until the tellers finish
+affinity_t affinity = AFFINITY_NONE;    // thread placement policy
+cpu_topology_t topology;        // usable CPUs
+int cpu_order[CPU_MAX];            // the CPUs in the order of the policy, teller i gets i % cpu_count
+int cpu_count = 0;
+const char *journal_path = NULL;    // journal the withdrawals, NULL: in memory only
+int journal_group = JOURNAL_GROUP;    // the maximum records per write and sync
+long flush_us = 0;            // the maximum wait for a group to fill, 0: write what is ready
+journal_t journal;
+int workers = 0;            // pool workers running the tellers as tasks, 0: a thread per teller
+pool_t pool;
+pool_wait_t round_wg = POOL_WAIT_INITIALIZER;    // the teller tasks of the round
+int fiber_workers = 0;            // worker threads running the tellers as fibers, 0: no fibers
+bool yield_each = false;        // give up the CPU after each transaction
+fiber_sched_t fibers;
+size_t teller_stack = 0;        // the stack reserved for one teller
+int cohort_nodes = 0;            // simulated nodes of the cohort lock, 0: the NUMA nodes
+int cohort_limit = COHORT_PASS_LIMIT;    // passes within a node in a row
+
+volatile long balance;            // shared variable, initial balance
+volatile long taken;            // the amount taken out of the balance (reservations included), with -I
+seqlock_t balance_seq = SEQLOCK_INITIALIZER;    // the writers of balance and taken, with -I
+volatile int tellers_done;        // the tellers that finished the round, stops the readers
+
+teller_t *tellers = NULL;        // the array of per-thread data
+reader_t *inquirers = NULL;        // the array of per-reader data
+
+// a slice of the balance owned by one teller (shard strategy)
+typedef struct {
+    volatile long balance;
+} __attribute__((aligned(CACHE_LINE))) shard_t;
+
+shard_t *shards = NULL;            // the balance split into per-thread shards
+
+// a published withdrawal request of one teller (fc strategy)
+typedef struct {
+    volatile int request;        // the amount to withdraw, 0: no pending request
+    volatile bool accepted;        // the result, valid once request is reset to 0
+} __attribute__((aligned(CACHE_LINE))) fc_slot_t;
+
+fc_slot_t *fc_slots = NULL;        // per-thread request slots
+
+// spins waiting for the combiner before the CPU is given up
+#define FC_SPIN_LIMIT    (1<<7)
+
+int verbose = 1;            // verbosity
+
+// critical section variables
+volatile bool locked = false;
+atomic_bool c11_locked = false;    // the lock of the C11 strategies
+ticket_lock_t ticket = TICKET_LOCK_INITIALIZER;
+mcs_lock_t mcs = MCS_LOCK_INITIALIZER;
+cohort_lock_t cohort;
+futex_lock_t futex = FUTEX_LOCK_INITIALIZER;
+fiber_mutex_t fmutex = FIBER_MUTEX_INITIALIZER;
+fiber_sem_t fsem = FIBER_SEM_INITIALIZER(1);
+
+// synchronization variables
+// barrier declaration
+barrier_type_t barrier_type = BARRIER_PTHREAD;
+barrier_t barrier;
+bool barrier_initialized = false;
+
+// release allocated barrier resources
+void release_barrier(void) {
+    if (barrier_initialized) {
+        // release the system resources allocated by the barrier
+        if ((errno = barrier_destroy(&barrier)))
+            perror("barrier_destroy");
+        barrier_initialized = false;
+    }
+}
+
+// release the per-thread data
+void release_tellers(void) {
+    int i;
+
+    if (tellers)
+        for (i = 0; i < threads; ++i) {
+            free(tellers[i].amounts);
+            free(tellers[i].wait_hist);
+            free(tellers[i].hold_hist);
+            free(tellers[i].commit_hist);
+        }
+    free(tellers);
+    tellers = NULL;
+    free(inquirers);
+    inquirers = NULL;
+    free(shards);
+    shards = NULL;
+    free(fc_slots);
+    fc_slots = NULL;
+    cohort_destroy(&cohort);
+}
+
+// synchronize all threads: tellers 0 to threads - 1, then the readers, the main thread is the last one
+// synchronizace vláken (včetně hlavního vlákna)
+static void sync_threads(int id) {
+    int rc;
+
+    // thread blocked at the barrier until count of blocked threads is equal to the value with which was the barrier initialized with (threads + 1)
+    switch ((rc = barrier_wait(&barrier, id))) {    // check the return code
+        case BARRIER_SERIAL_THREAD:
+            // this will be executed only once (by only one thread)
+            // the barrier is reused for the next round: keep it
+        case 0:
+            break;
+        default:
+            // error state
+            errno = rc;
+            perror("barrier_wait");
+            exit(EXIT_FAILURE);
+    }
+}
+
+// enter the critical section using the selected strategy
+static inline void lock_acquire(teller_t *self) {
+    switch (strategy) {
+        case LOCK_SW1:
+            while (locked);
+            locked = true;
+            break;
+        case LOCK_SW1_SCHED:
+            while (locked)
+                sched_yield();    // relinquish the CPU
+            locked = true;
+            break;
+        case LOCK_XCHG:
+            while (test_and_set(&locked));
+            break;
+        case LOCK_XCHG_SCHED:
+            while (test_and_set(&locked))
+                sched_yield();    // relinquish the CPU
+            break;
+        case LOCK_C11:
+            while (test_and_set_c11(&c11_locked));
+            break;
+        case LOCK_C11_SCHED:
+            while (test_and_set_c11(&c11_locked))
+                sched_yield();    // relinquish the CPU
+            break;
+        case LOCK_FILTER:
+            filter_wait(self->id);
+            break;
+        case LOCK_BAKERY:
+            bakery_wait(self->id);
+            break;
+        case LOCK_TTAS:
+            ttas_lock(&locked);
+            break;
+        case LOCK_TICKET:
+            ticket_lock(&ticket);
+            break;
+        case LOCK_MCS:
+            mcs_lock(&mcs, &self->node);
+            break;
+        case LOCK_COHORT:
+            cohort_lock(&cohort, self->cohort_node);
+            break;
+        case LOCK_FUTEX:
+            futex_lock(&futex);
+            break;
+        case LOCK_FMUTEX:
+            fiber_mutex_lock(&fmutex);
+            break;
+        case LOCK_FSEM:
+            fiber_sem_wait(&fsem);
+            break;
+        default:
+            break;
+    }
+}
+
+// leave the critical section
+static inline void lock_release(teller_t *self) {
+    switch (strategy) {
+        case LOCK_TICKET:
+            ticket_unlock(&ticket);
+            break;
+        case LOCK_MCS:
+            mcs_unlock(&mcs, &self->node);
+            break;
+        case LOCK_COHORT:
+            cohort_unlock(&cohort, self->cohort_node);
+            break;
+        case LOCK_FUTEX:
+            futex_unlock(&futex);
+            break;
+        case LOCK_FMUTEX:
+            fiber_mutex_unlock(&fmutex);
+            break;
+        case LOCK_FSEM:
+            fiber_sem_post(&fsem);
+            break;
+        case LOCK_C11:
+        case LOCK_C11_SCHED:
+            release_lock_c11(&c11_locked);
+            break;
+        case LOCK_FILTER:
+            filter_post(self->id);
+            break;
+        case LOCK_BAKERY:
+            bakery_post(self->id);
+            break;
+        case LOCK_SW1:
+        case LOCK_SW1_SCHED:
+            locked = false;    // no barrier: the strategy is not correct anyway
+            break;
+        default:
+            release_lock(&locked);
+            break;
+    }
+}
+
+// the critical section changes the balance: the readers must not use a half-done change
+static inline void balance_write_begin(void) {
+    if (readers)
+        seqlock_write_begin(&balance_seq);
+}
+
+// the balance is consistent again, amount was taken out of it
+static inline void balance_write_end(long amount) {
+    if (readers) {
+        taken += amount;
+        seqlock_write_end(&balance_seq);
+    }
+}
+
+// enter the critical section, record the wait, return the time of the entry
+static inline uint64_t cs_enter(teller_t *self) {
+    uint64_t t = histograms ? tsc_read() : 0;
+
+    lock_acquire(self);
+    if (histograms) {
+        uint64_t entered = tsc_read();
+
+        hist_record(self->wait_hist, entered - t);
+        t = entered;
+    }
+    return t;
+}
+
+// leave the critical section entered at the given time, record the hold time
+static inline void cs_leave(teller_t *self, uint64_t entered) {
+    if (histograms)
+        hist_record(self->hold_hist, tsc_read() - entered);
+    lock_release(self);
+}
+
+// withdraw the amount from the shared balance in the critical section, return false if rejected
+static inline bool withdraw_locked(teller_t *self, int amount) {
+    bool accepted;
+    uint64_t entered;
+
+    entered = cs_enter(self);
+    // critical section - start
+    if (balance < amount) {    // if not enough: reject withdrawal
+        if (verbose > 1)
+            fprintf(stderr, "Transaction rejected: %ld, %d\n", balance, -amount);
+        accepted = false;
+    } else {
+        balance_write_begin();
+        balance -= amount;        // do withdrawal
+        balance_write_end(amount);
+        accepted = true;
+    }
+    // critical section - end
+    cs_leave(self, entered);
+
+    return accepted;
+}
+
+// withdraw the amount without a lock: the check and the subtraction is one compare-and-swap
+static inline bool withdraw_cas(teller_t *self, int amount) {
+    long old = balance;
+
+    for (;;) {
+        if (old < amount) {    // if not enough: reject withdrawal
+            if (verbose > 1)
+                fprintf(stderr, "Transaction rejected: %ld, %d\n", old, -amount);
+            return false;
+        }
+        // the balance is the only shared datum: no ordering with other memory is needed
+        if (__atomic_compare_exchange_n(&balance, &old, old - amount, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return true;
+        // another thread changed the balance since our read, old is the current value now
+        ++self->cas_failures;
+    }
+}
+
+// move balance from the other shards to our own one until it covers the amount,
+// return false if all other shards are empty
+static bool steal(teller_t *self, int amount) {
+    shard_t *own = &shards[self->id];
+    shard_t *victim;
+    bool found = false;
+    long old, take;
+    int i;
+
+    for (i = 1; i < threads && own->balance < amount; ++i) {
+        victim = &shards[(self->id + i) % threads];
+        old = victim->balance;
+        while (old > 0) {
+            // take a half of a large shard, the whole small one
+            take = old > 2 * amount ? old / 2 : old;
+            if (__atomic_compare_exchange_n(&victim->balance, &old, old - take, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                __atomic_fetch_add(&own->balance, take, __ATOMIC_RELAXED);
+                ++self->steals;
+                found = true;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+// return the unused reservation to the balance and reserve a new block of at most want
+static inline void reserve(teller_t *self, long want) {
+    uint64_t entered;
+    long returned = self->reserved;
+
+    entered = cs_enter(self);
+    // critical section - start
+    balance_write_begin();
+    balance += self->reserved;
+    self->reserved = balance < want ? balance : want;
+    balance -= self->reserved;
+    balance_write_end(self->reserved - returned);
+    // critical section - end
+    cs_leave(self, entered);
+    ++self->reservations;
+}
+
+// withdraw the amount from the reservation of this teller, refill it in the critical section
+// once per batch withdrawals
+static inline bool withdraw_batch(teller_t *self, int amount) {
+    if (self->reserved < amount) {
+        reserve(self, (long) batch * max_withdraw);
+        // the rest of the balance is ours and too small: return it and stop, instead of
+        // taking the lock again on each of the next withdrawals
+        if (self->reserved < amount && balance <= 0) {
+            reserve(self, 0);
+            self->drained = true;
+        }
+    }
+    if (self->reserved < amount) {    // if not enough: reject withdrawal
+        if (verbose > 1)
+            fprintf(stderr, "Transaction rejected: %ld, %d\n", self->reserved, -amount);
+        return false;
+    }
+    self->reserved -= amount;        // do withdrawal, no other thread touches our reservation
+    return true;
+}
+
+// withdraw the amount from our own shard, steal from the others when it runs dry
+static inline bool withdraw_shard(teller_t *self, int amount) {
+    shard_t *own = &shards[self->id];
+    long old = own->balance;
+
+    for (;;) {
+        if (old < amount) {
+            if (steal(self, amount)) {
+                old = own->balance;
+                continue;
+            }
+            // if not enough: reject withdrawal
+            if (verbose > 1)
+                fprintf(stderr, "Transaction rejected: %ld, %d\n", old, -amount);
+            self->drained = old <= 0;
+            return false;
+        }
+        // thieves may take from our shard too, but the cache line stays here: no contention
+        if (__atomic_compare_exchange_n(&own->balance, &old, old - amount, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return true;
+    }
+}
+
+// apply all published requests to the balance, the caller holds the combiner lock
+static void combine(teller_t *self) {
+    fc_slot_t *slot;
+    int amount;
+    long applied = 0;
+    int i;
+
+    balance_write_begin();        // one write for the whole pass
+    for (i = 0; i < threads; ++i) {
+        slot = &fc_slots[i];
+        if (!(amount = __atomic_load_n(&slot->request, __ATOMIC_ACQUIRE)))
+            continue;
+        if (balance < amount) {    // if not enough: reject withdrawal
+            if (verbose > 1)
+                fprintf(stderr, "Transaction rejected: %ld, %d\n", balance, -amount);
+            slot->accepted = false;
+        } else {
+            balance -= amount;        // do withdrawal
+            applied += amount;
+            slot->accepted = true;
+        }
+        __atomic_store_n(&slot->request, 0, __ATOMIC_RELEASE);    // the request is served
+        ++self->fc_applied;
+    }
+    balance_write_end(applied);
+    ++self->fc_passes;
+}
+
+// publish the request and wait until some combiner (possibly this thread) serves it
+static inline bool withdraw_fc(teller_t *self, int amount) {
+    fc_slot_t *slot = &fc_slots[self->id];
+    unsigned int spins = 0;
+
+    __atomic_store_n(&slot->request, amount, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&slot->request, __ATOMIC_ACQUIRE)) {
+        if (!locked && !test_and_set(&locked)) {
+            // we are the combiner: the balance stays in our cache for the whole pass
+            combine(self);
+            release_lock(&locked);
+        } else if (++spins % FC_SPIN_LIMIT) {
+            cpu_relax();
+        } else {
+            sched_yield();    // the combiner is probably preempted
+        }
+    }
+    return slot->accepted;
+}
+
+// withdraw the amount from the shared balance, return false if rejected
+static inline bool withdraw(teller_t *self, int amount) {
+    uint64_t start = histograms ? tsc_read() : 0;
+    bool accepted;
+
+    switch (strategy) {
+        case LOCK_CAS:
+            accepted = withdraw_cas(self, amount);
+            break;
+        case LOCK_SHARD:
+            accepted = withdraw_shard(self, amount);
+            break;
+        case LOCK_FC:
+            accepted = withdraw_fc(self, amount);
+            break;
+        default:
+            // cs_enter() and cs_leave() record the wait and the hold time
+            return batch > 1 ? withdraw_batch(self, amount) : withdraw_locked(self, amount);
+    }
+    // no lock: the wait is the latency of the whole withdrawal
+    if (histograms)
+        hist_record(self->wait_hist, tsc_read() - start);
+    return accepted;
+}
+
+// journal the accepted withdrawal, return after the record is durable
+static inline void commit(teller_t *self, int amount) {
+    uint64_t start = tsc_read();
+
+    journal_wait(&journal, journal_append(&journal, self->id, amount));
+    hist_record(self->commit_hist, tsc_read() - start);
+}
+
+// no resources left for this teller
+static inline bool bank_empty(teller_t *self) {
+    switch (strategy) {
+        case LOCK_SHARD:
+            return self->drained;
+        default:
+            return self->drained || (balance <= 0 && self->reserved <= 0);
+    }
+}
+
+// per-thread preparation before the first round
+static void teller_setup(teller_t *self) {
+    long i;
+
+    // the whole stream of amounts in bulk, before the measurement
+    if (pregenerate) {
+        if (!(self->amounts = malloc(max_transactions * sizeof(int)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        rng_seed(&self->rng, seed, self->id);
+        for (i = 0; i < max_transactions; ++i)
+            self->amounts[i] = 1 + rng_below(&self->rng, max_withdraw);
+    }
+
+    if (histograms) {
+        if (!(self->wait_hist = malloc(sizeof(hist_t))) || !(self->hold_hist = malloc(sizeof(hist_t)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (journal_path && !(self->commit_hist = malloc(sizeof(hist_t)))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (counters)
+        perf_open(&self->perf);
+}
+
+// the cohort node of the teller: its group of CPUs (-N) or the NUMA node of its CPU
+static int teller_node(const teller_t *t) {
+    const cpu_info_t *c;
+
+    // simulated: the position of the CPU in the placement order, of the teller if not pinned
+    if (cohort_nodes)
+        return t->pinned >= 0 ? (long) (t->id % cpu_count) * cohort_nodes / cpu_count
+                              : (long) t->id * cohort_nodes / threads;
+    c = topo_find(&topology, t->pinned >= 0 ? t->pinned : sched_getcpu());
+    return c ? c->node : 0;
+}
+
+// one round of transactions, the results are stored to the teller
+static void teller_round(teller_t *self) {
+    long i;
+    long withdrawals = 0;
+    long withdrawn = 0;
+    int amount;
+    bool finished;
+    struct timespec cpu_start;
+    struct rusage usage_start, usage_end;
+
+    // every round replays the same transactions: the same seed gives the same stream
+    rng_seed(&self->rng, seed, self->id);    // RNG init
+    self->cas_failures = self->steals = self->reservations = 0;
+    self->fc_passes = self->fc_applied = 0;
+    self->drained = false;
+    if (histograms) {
+        hist_init(self->wait_hist);
+        hist_init(self->hold_hist);
+    }
+    if (journal_path)
+        hist_init(self->commit_hist);
+    if (strategy == LOCK_COHORT)
+        self->cohort_node = teller_node(self);    // where the teller starts, it may migrate later
+
+    if (!workers && !fiber_workers)
+        sync_threads(self->id);        // synchronize threads start / synchronizace startu vláken
+    clock_gettime(CLOCK_MONOTONIC, &self->start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    getrusage(RUSAGE_THREAD, &usage_start);
+    if (counters)
+        perf_start(&self->perf);
+
+    // each thread makes at most max_transactions withdrawals
+    for (i = 0, finished = false; i < max_transactions && !finished; ++i) {
+
+        // random amount: 1 to max_withdraw
+        amount = self->amounts ? self->amounts[i] : 1 + (int) rng_below(&self->rng, max_withdraw);
+        // try withdrawal
+        if (withdraw(self, amount)) {
+            ++withdrawals;
+            withdrawn += amount;    // sum up total withdrawal by this thread
+            if (journal_path)
+                commit(self, amount);    // acknowledged only when durable
+        }
+        // set finished flag if no resources left
+        finished = bank_empty(self);
+        // the next customer: let the other tellers run
+        if (yield_each) {
+            if (fiber_workers)
+                fiber_yield();
+            else
+                sched_yield();
+        }
+    }
+
+    // return the rest of the reservation so that the balance is complete
+    if (self->reserved)
+        reserve(self, 0);
+
+    if (counters)
+        perf_stop(&self->perf);
+    getrusage(RUSAGE_THREAD, &usage_end);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &self->cpu);
+    clock_gettime(CLOCK_MONOTONIC, &self->end);
+    self->last_cpu = sched_getcpu();
+
+    // CPU time and context switches of this thread during the transactions;
+    // a fiber shares its workers with the other fibers and moves between them: not measured
+    if (fiber_workers) {
+        memset(&self->cpu, 0, sizeof(self->cpu));
+        self->nvcsw = self->nivcsw = 0;
+    } else {
+        self->cpu.tv_sec -= cpu_start.tv_sec;
+        self->cpu.tv_nsec -= cpu_start.tv_nsec;
+        if (self->cpu.tv_nsec < 0) {
+            self->cpu.tv_nsec += 1000000000L;
+            --self->cpu.tv_sec;
+        }
+        self->nvcsw = usage_end.ru_nvcsw - usage_start.ru_nvcsw;
+        self->nivcsw = usage_end.ru_nivcsw - usage_start.ru_nivcsw;
+    }
+
+    // store the results to the shared array only once
+    self->transactions = i;
+    self->withdrawals = withdrawals;
+    self->withdrawn = withdrawn;
+
+    if (verbose > 1)
+        fprintf(stderr, "Thread %2d: transactions performed: %9ld\n", self->id, i);
+
+    __atomic_fetch_add(&tellers_done, 1, __ATOMIC_RELAXED);    // the readers stop after the last one
+    if (!workers && !fiber_workers)
+        sync_threads(self->id);        // the round is over: main collects the results
+}
+
+// one round of a teller as a task of the pool
+void teller_task(void *arg) {
+    teller_round(arg);
+}
+
+// one round of a teller as a fiber
+void teller_fiber(void *arg) {
+    teller_round(arg);
+}
+
+void *do_withdrawals(void *arg) {
+    teller_t *self = arg;
+    int round;
+
+    teller_setup(self);
+    sync_threads(self->id);        // all threads ready
+
+    for (round = 0; round < warmup + rounds; ++round)
+        teller_round(self);
+
+    if (counters)
+        perf_close(&self->perf);
+
+    return NULL;
+}
+
+// one round of inquiries while the tellers run
+static void reader_round(reader_t *self) {
+    long limit = ratio ? ratio * max_transactions : -1;
+    long inquiries = 0, retries = 0, inconsistent = 0;
+    long b, t;
+    unsigned int seq;
+
+    sync_threads(threads + self->id);    // start with the tellers
+    clock_gettime(CLOCK_MONOTONIC, &self->start);
+
+    while (inquiries != limit && __atomic_load_n(&tellers_done, __ATOMIC_RELAXED) < threads) {
+        // read the pair again until no teller changed it meanwhile
+        for (;;) {
+            seq = seqlock_read_begin(&balance_seq);
+            b = balance;
+            t = taken;
+            if (!seqlock_read_retry(&balance_seq, seq))
+                break;
+            ++retries;
+        }
+        if (b + t != initial_amount)
+            ++inconsistent;
+        ++inquiries;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &self->end);
+    // store the results to the shared array only once
+    self->inquiries = inquiries;
+    self->retries = retries;
+    self->inconsistent = inconsistent;
+
+    sync_threads(threads + self->id);    // the round is over
+}
+
+void *do_inquiries(void *arg) {
+    reader_t *self = arg;
+    int round;
+
+    sync_threads(threads + self->id);    // all threads ready
+
+    for (round = 0; round < warmup + rounds; ++round)
+        reader_round(self);
+
+    return NULL;
+}
+
+// print usage and exit
+static void usage(const char *prog, int status) {
+    int s;
+
+    fprintf(status ? stderr : stdout,
+            "usage: %s [-l strategy] [-t threads] [-b balance] [-n transactions]\n"
+            "          [-m max_withdraw] [-B batch] [-s seed] [-P] [-c] [-H]\n"
+            "          [-Y barrier] [-W warmup] [-R rounds] [-a affinity]\n"
+            "          [-I readers] [-r ratio] [-J journal] [-G group] [-F flush_us]\n"
+            "          [-T workers] [-X workers] [-y] [-N nodes] [-L passes] [-v] [-q]\n"
+            "  -l strategy      lock strategy (default: %s)\n"
+            "  -t threads       the number of concurrent threads (default: %d)\n"
+            "  -b balance       initial balance (default: %d)\n"
+            "  -n transactions  maximum transactions per thread (default: balance / threads)\n"
+            "  -m max_withdraw  maximum amount per transaction (default: %d)\n"
+            "  -B batch         reserve batch * max_withdraw per critical section (default: 1, lock strategies)\n"
+            "  -s seed          RNG seed, the same seed gives the same transactions (default: random)\n"
+            "  -P               pre-generate all amounts before the start\n"
+            "  -c               measure performance counters (perf_event_open)\n"
+            "  -H               record lock wait and hold time histograms\n"
+            "  -Y barrier       round start barrier: pthread, sr (sense-reversing), tree (default: pthread)\n"
+            "  -W warmup        unreported warmup rounds (default: 0)\n"
+            "  -R rounds        measured rounds, each from the initial balance (default: 1)\n"
+            "  -a affinity      pin the threads: compact, scatter, smt or a CPU list like 0,2,4-7 (default: none)\n"
+            "  -I readers       balance inquiry threads reading through a sequence lock (default: 0)\n"
+            "  -r ratio         inquiries per reader for each teller transaction (default: until the tellers finish)\n"
+            "  -J journal       make the withdrawals durable in the journal file, group commit\n"
+            "  -G group         maximum records per journal write and sync (default: %d)\n"
+            "  -F flush_us      maximum wait in microseconds for a journal group to fill (default: 0)\n"
+            "  -T workers       run the tellers as tasks of a work-stealing pool (default: a thread per teller)\n"
+            "  -X workers       run the tellers as fibers on the worker threads (default: a thread per teller)\n"
+            "  -y               yield the CPU after each transaction\n"
+            "  -N nodes         cohort: simulated nodes, groups of the CPUs or tellers (default: the NUMA nodes)\n"
+            "  -L passes        cohort: passes within a node before the global release (default: %d)\n"
+            "  -v               increase verbosity\n"
+            "  -q               print the result record only\n"
+            "strategies:\n",
+            prog, strategies[LOCK_XCHG].name, THREADS, INITIAL_AMOUNT, MAX_WITHDRAW, JOURNAL_GROUP,
+            COHORT_PASS_LIMIT);
+    for (s = 0; s < LOCK_STRATEGIES; ++s)
+        fprintf(status ? stderr : stdout, "  %-16s %s\n", strategies[s].name, strategies[s].desc);
+    exit(status);
+}
+
+// find the lock strategy by its name, exit on error
+static lock_strategy_t parse_strategy(const char *prog, const char *name) {
+    int s;
+
+    for (s = 0; s < LOCK_STRATEGIES; ++s)
+        if (!strcmp(name, strategies[s].name))
+            return s;
+    fprintf(stderr, "%s: unknown strategy: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return LOCK_STRATEGIES;    // not reached
+}
+
+// find the barrier type by its name, exit on error
+static barrier_type_t parse_barrier(const char *prog, const char *name) {
+    int b;
+
+    for (b = 0; b < BARRIER_TYPES; ++b)
+        if (!strcmp(name, barrier_names[b]))
+            return b;
+    fprintf(stderr, "%s: unknown barrier: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return BARRIER_TYPES;    // not reached
+}
+
+// set the placement policy by its name or read the list of CPUs, exit on error
+static void parse_affinity(const char *prog, const char *arg) {
+    int a;
+    int i;
+
+    topo_read(&topology);
+    for (a = 0; a < AFFINITY_POLICIES; ++a)
+        if (a != AFFINITY_LIST && !strcmp(arg, affinity_names[a])) {
+            affinity = a;
+            cpu_count = topo_order(&topology, affinity, cpu_order);
+            return;
+        }
+    affinity = AFFINITY_LIST;
+    if ((cpu_count = topo_parse_list(arg, cpu_order, CPU_MAX)) <= 0) {
+        fprintf(stderr, "%s: invalid affinity: %s\n", prog, arg);
+        usage(prog, EXIT_FAILURE);
+    }
+    for (i = 0; i < cpu_count; ++i)
+        if (!topo_find(&topology, cpu_order[i])) {
+            fprintf(stderr, "%s: CPU %d is not available\n", prog, cpu_order[i]);
+            exit(EXIT_FAILURE);
+        }
+}
+
+// print the CPU of the teller and where it is in the topology as key=value pairs
+static void print_placement(const teller_t *t) {
+    const cpu_info_t *c;
+
+    printf(" cpu=%d", t->last_cpu);
+    if (t->pinned >= 0 && (c = topo_find(&topology, t->pinned)))
+        printf(" package=%d core=%d smt=%d node=%d", c->package, c->core, c->smt, c->node);
+}
+
+// print the measured performance counters as key=value pairs
+static void print_counters(const perf_counters_t *pc) {
+    int e;
+
+    for (e = 0; e < PERF_EVENTS; ++e)
+        if (perf_valid(pc, e))
+            printf(" %s=%llu", perf_events[e].name, (unsigned long long) pc->value[e]);
+    if (perf_valid(pc, PERF_CYCLES) && perf_valid(pc, PERF_INSTRUCTIONS) && pc->value[PERF_CYCLES])
+        printf(" ipc=%.3f", (double) pc->value[PERF_INSTRUCTIONS] / pc->value[PERF_CYCLES]);
+}
+
+// print the wait and hold time percentiles as key=value pairs
+static void print_histograms(const hist_t *wait, const hist_t *hold, double ns_per_tick) {
+    hist_print("wait", wait, ns_per_tick);
+    if (hold->count)
+        hist_print("hold", hold, ns_per_tick);
+}
+
+// print the journal group commit statistics of the round as key=value pairs
+static void print_journal(const journal_stats_t *js, double elapsed, const hist_t *commit, double ns_per_tick) {
+    printf(" commits=%ld commits_per_s=%.0f groups=%ld group_mean=%.2f group_max=%ld sync_us=%.1f",
+           js->records, elapsed > 0 ? js->records / elapsed : 0.0, js->groups,
+           js->groups ? (double) js->records / js->groups : 0.0, js->max_group,
+           js->groups ? js->sync_s * 1e6 / js->groups : 0.0);
+    hist_print("commit", commit, ns_per_tick);
+}
+
+// reset the bank to the initial balance before a round
+static void reset_bank(void) {
+    int i;
+
+    balance = initial_amount;
+    taken = 0;
+    tellers_done = 0;
+    // split the balance among the tellers, the remainder goes to the first ones
+    if (strategy == LOCK_SHARD) {
+        for (i = 0; i < threads; ++i)
+            shards[i].balance = initial_amount / threads + (i < initial_amount % threads);
+        balance = 0;
+    }
+    if (strategy == LOCK_FC)
+        memset(fc_slots, 0, threads * sizeof(fc_slot_t));
+    if (strategy == LOCK_COHORT)
+        for (i = 0; i < cohort.nodes; ++i)
+            cohort.node[i].acquired = cohort.node[i].passed = 0;
+}
+
+// sum up the results of the round, print the thread and result records and return the throughput
+static double report_round(int round, const struct timespec *cpu_start, const struct timespec *cpu_end,
+                           double ns_per_tick) {
+    int i;
+    long total_transactions = 0;
+    long total_withdrawals = 0;
+    long total_withdrawn = 0;
+    long total_cas_failures = 0;
+    long total_steals = 0;
+    long total_reservations = 0;
+    long total_fc_passes = 0;
+    long total_fc_applied = 0;
+    double sum_squares = 0;        // for Jain's fairness index
+    double thread_cpu = 0;        // CPU time of all threads during the transactions
+    long total_nvcsw = 0, total_nivcsw = 0;
+    const struct timespec *start, *end, *last_start;
+    perf_counters_t total_perf;        // sums of the counters of all threads
+    static hist_t total_wait, total_hold, total_commit;    // merged histograms of all threads
+    int e;
+    double elapsed, throughput;
+    long total_inquiries = 0, total_retries = 0, total_inconsistent = 0;
+    const struct timespec *read_start = NULL, *read_end = NULL;
+    double read_elapsed = 0;
+    struct rusage usage;
+    long total_switches = 0;
+    long total_acquired = 0, total_passed = 0;
+
+    // the same events are available to all threads
+    total_perf = tellers[0].perf;
+    memset(total_perf.value, 0, sizeof(total_perf.value));
+    hist_init(&total_wait);
+    hist_init(&total_hold);
+    hist_init(&total_commit);
+
+    // sum up the totals of each thread, measure from the first start to the last finish
+    start = last_start = &tellers[0].start;
+    end = &tellers[0].end;
+    for (i = 0; i < threads; ++i) {
+        if (elapsed_seconds(&tellers[i].start, start) > 0)
+            start = &tellers[i].start;
+        if (elapsed_seconds(last_start, &tellers[i].start) > 0)
+            last_start = &tellers[i].start;
+        if (elapsed_seconds(end, &tellers[i].end) > 0)
+            end = &tellers[i].end;
+        total_transactions += tellers[i].transactions;
+        total_withdrawals += tellers[i].withdrawals;
+        total_withdrawn += tellers[i].withdrawn;
+        total_cas_failures += tellers[i].cas_failures;
+        total_steals += tellers[i].steals;
+        total_reservations += tellers[i].reservations;
+        total_fc_passes += tellers[i].fc_passes;
+        total_fc_applied += tellers[i].fc_applied;
+        thread_cpu += tellers[i].cpu.tv_sec + tellers[i].cpu.tv_nsec / 1e9;
+        total_nvcsw += tellers[i].nvcsw;
+        total_nivcsw += tellers[i].nivcsw;
+        for (e = 0; e < PERF_EVENTS; ++e)
+            total_perf.value[e] += tellers[i].perf.value[e];
+        if (histograms) {
+            hist_merge(&total_wait, tellers[i].wait_hist);
+            hist_merge(&total_hold, tellers[i].hold_hist);
+        }
+        if (journal_path)
+            hist_merge(&total_commit, tellers[i].commit_hist);
+        sum_squares += (double) tellers[i].withdrawals * tellers[i].withdrawals;
+        if (verbose) {
+            printf("thread round=%d id=%d transactions=%ld withdrawals=%ld withdrawn=%ld",
+                   round, i, tellers[i].transactions, tellers[i].withdrawals, tellers[i].withdrawn);
+            if (!fiber_workers)        // not measured for fibers
+                printf(" cpu_s=%.6f vcsw=%ld ivcsw=%ld",
+                       tellers[i].cpu.tv_sec + tellers[i].cpu.tv_nsec / 1e9, tellers[i].nvcsw, tellers[i].nivcsw);
+            if (strategy == LOCK_CAS)
+                printf(" cas_failures=%ld", tellers[i].cas_failures);
+            if (strategy == LOCK_SHARD)
+                printf(" steals=%ld", tellers[i].steals);
+            if (batch > 1)
+                printf(" reservations=%ld", tellers[i].reservations);
+            if (strategy == LOCK_FC)
+                printf(" fc_passes=%ld fc_applied=%ld", tellers[i].fc_passes, tellers[i].fc_applied);
+            if (strategy == LOCK_COHORT)
+                printf(" cohort_node=%d", tellers[i].cohort_node);
+            print_placement(&tellers[i]);
+            if (counters)
+                print_counters(&tellers[i].perf);
+            if (histograms)
+                print_histograms(tellers[i].wait_hist, tellers[i].hold_hist, ns_per_tick);
+            if (journal_path)
+                hist_print("commit", tellers[i].commit_hist, ns_per_tick);
+            putchar('\n');
+        }
+    }
+
+    elapsed = elapsed_seconds(start, end);
+    throughput = elapsed > 0 ? total_withdrawals / elapsed : 0.0;
+
+    // the inquiries, measured from the first reader start to the last reader finish
+    for (i = 0; i < readers; ++i) {
+        if (!read_start || elapsed_seconds(&inquirers[i].start, read_start) > 0)
+            read_start = &inquirers[i].start;
+        if (!read_end || elapsed_seconds(read_end, &inquirers[i].end) > 0)
+            read_end = &inquirers[i].end;
+        total_inquiries += inquirers[i].inquiries;
+        total_retries += inquirers[i].retries;
+        total_inconsistent += inquirers[i].inconsistent;
+        if (verbose)
+            printf("reader round=%d id=%d inquiries=%ld retries=%ld inconsistent=%ld throughput=%.0f cpu=%d\n",
+                   round, i, inquirers[i].inquiries, inquirers[i].retries, inquirers[i].inconsistent,
+                   elapsed_seconds(&inquirers[i].start, &inquirers[i].end) > 0
+                       ? inquirers[i].inquiries / elapsed_seconds(&inquirers[i].start, &inquirers[i].end) : 0.0,
+                   inquirers[i].pinned);
+    }
+    if (readers)
+        read_elapsed = elapsed_seconds(read_start, read_end);
+
+    // report the totals, the throughput and the new state
+    // fairness: 1 if all threads made the same number of withdrawals, 1/threads if one made all
+    printf("result strategy=%s threads=%d round=%d elapsed_s=%.6f transactions=%ld withdrawals=%ld"
+           " rejected=%ld throughput=%.0f ns_per_op=%.2f fairness=%.3f cpu_s=%.6f balance=%ld withdrawn=%ld lost=%ld",
+           strategies[strategy].name, threads, round, elapsed, total_transactions, total_withdrawals,
+           total_transactions - total_withdrawals, throughput,
+           total_transactions ? elapsed * 1e9 / total_transactions : 0.0,
+           sum_squares > 0 ? (double) total_withdrawals * total_withdrawals / (threads * sum_squares) : 1.0,
+           elapsed_seconds(cpu_start, cpu_end),
+           balance, total_withdrawn, initial_amount - balance - total_withdrawn);
+    // start skew: how far apart the barrier released the threads (first to last start)
+    printf(" start_skew_ns=%.0f", elapsed_seconds(start, last_start) * 1e9);
+    // wall vs. CPU: how many CPUs were kept busy and how much CPU time one transaction cost;
+    // busy waiting shows as cores_busy close to min(threads, cpus) without more throughput;
+    // not measured for fibers, which share their worker threads
+    if (!fiber_workers)
+        printf(" thread_cpu_s=%.6f cores_busy=%.2f cpu_ns_per_op=%.2f vcsw=%ld ivcsw=%ld",
+               thread_cpu, elapsed > 0 ? thread_cpu / elapsed : 0.0,
+               total_transactions ? thread_cpu * 1e9 / total_transactions : 0.0, total_nvcsw, total_nivcsw);
+    // failure rate: failed attempts per compare-and-swap attempt
+    if (strategy == LOCK_CAS)
+        printf(" cas_failures=%ld cas_failure_rate=%.4f", total_cas_failures,
+               total_cas_failures ? (double) total_cas_failures / (total_cas_failures + total_withdrawals) : 0.0);
+    if (strategy == LOCK_SHARD)
+        printf(" steals=%ld", total_steals);
+    if (batch > 1)
+        printf(" batch=%d reservations=%ld", batch, total_reservations);
+    // requests applied per combining pass
+    if (strategy == LOCK_FC)
+        printf(" fc_passes=%ld fc_per_pass=%.2f", total_fc_passes,
+               total_fc_passes ? (double) total_fc_applied / total_fc_passes : 0.0);
+    // cohort: the share of the acquisitions passed within a node, without the global lock
+    if (strategy == LOCK_COHORT) {
+        for (i = 0; i < cohort.nodes; ++i) {
+            total_acquired += cohort.node[i].acquired;
+            total_passed += cohort.node[i].passed;
+        }
+        printf(" cohort_nodes=%d cohort_limit=%d global_acquisitions=%ld local_passes=%ld pass_ratio=%.3f",
+               cohort.nodes, cohort.limit, total_acquired, total_passed,
+               total_acquired + total_passed ? (double) total_passed / (total_acquired + total_passed) : 0.0);
+    }
+    // readers and writers separately: the readers should scale without slowing the tellers
+    if (readers)
+        printf(" readers=%d inquiries=%ld read_throughput=%.0f read_retries=%ld inconsistent=%ld read_write_ratio=%.2f",
+               readers, total_inquiries, read_elapsed > 0 ? total_inquiries / read_elapsed : 0.0,
+               total_retries, total_inconsistent,
+               total_transactions ? (double) total_inquiries / total_transactions : 0.0);
+    // memory: the stack reserved for each teller, the peak resident memory of the process;
+    // fibers: switches from a worker to a fiber (a start, or a resume after a yield or a wait)
+    getrusage(RUSAGE_SELF, &usage);
+    printf(" stack_kb=%zu maxrss_kb=%ld", teller_stack / 1024, usage.ru_maxrss);
+    if (fiber_workers) {
+        for (i = 0; i < fiber_workers; ++i)
+            total_switches += fibers.workers[i].switches;
+        printf(" fiber_workers=%d fiber_switches=%ld switches_per_op=%.2f max_stacks_kb=%zu", fiber_workers,
+               total_switches, total_transactions ? (double) total_switches / total_transactions : 0.0,
+               fibers.max_stack_bytes / 1024);
+    }
+    // teller to CPU mapping, in the order of the tellers
+    if (affinity != AFFINITY_NONE) {
+        printf(" affinity=%s cpu_map=", affinity_names[affinity]);
+        for (i = 0; i < threads; ++i)
+            printf(i ? ",%d" : "%d", tellers[i].pinned);
+    }
+    if (counters)
+        print_counters(&total_perf);
+    if (histograms)
+        print_histograms(&total_wait, &total_hold, ns_per_tick);
+    // group commit: the fewer syncs per commit, the more commits per second
+    if (journal_path)
+        print_journal(&journal.stats, elapsed, &total_commit, ns_per_tick);
+    putchar('\n');
+
+    // check the result and report
+    if (balance + total_withdrawn != initial_amount)
+        fprintf(stderr, "LOST TRANSACTIONS DETECTED!\n"
+                        "initial − new != total withdrawal (%ld != %ld)\n",
+                initial_amount - balance, total_withdrawn);
+
+    return throughput;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int i;
+    int round;
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    struct timespec cpu_start, cpu_end;    // process CPU time, all threads
+    double ns_per_tick = 0;
+    bool seeded = false;
+    double throughput, sum_throughput = 0, min_throughput = 0, max_throughput = 0;
+    pthread_attr_t attr;
+
+    // options
+    while ((opt = getopt(argc, argv, "l:t:b:n:m:B:s:PcHY:W:R:a:I:r:J:G:F:T:X:yN:L:vqh")) != -1) {
+        switch (opt) {
+            case 'l':
+                strategy = parse_strategy(argv[0], optarg);
+                break;
+            case 't':
+                threads = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'b':
+                initial_amount = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'n':
+                max_transactions = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'm':
+                max_withdraw = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'B':
+                batch = parse_positive(argv[0], opt, optarg);
+                break;
+            case 's':
+                seed = parse_seed(argv[0], opt, optarg);
+                seeded = true;
+                break;
+            case 'P':
+                pregenerate = true;
+                break;
+            case 'c':
+                counters = true;
+                break;
+            case 'H':
+                histograms = true;
+                break;
+            case 'Y':
+                barrier_type = parse_barrier(argv[0], optarg);
+                break;
+            case 'W':
+                warmup = parse_nonnegative(argv[0], opt, optarg);
+                break;
+            case 'R':
+                rounds = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'a':
+                parse_affinity(argv[0], optarg);
+                break;
+            case 'I':
+                readers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'r':
+                ratio = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'J':
+                journal_path = optarg;
+                break;
+            case 'G':
+                journal_group = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'F':
+                flush_us = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'T':
+                workers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'X':
+                fiber_workers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'y':
+                yield_each = true;
+                break;
+            case 'N':
+                cohort_nodes = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'L':
+                cohort_limit = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'v':
+                ++verbose;
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+            default:
+                usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    if (!max_transactions)
+        max_transactions = initial_amount / threads;
+    if ((strategy == LOCK_FILTER && threads > FILTER_MAX_THREADS)
+        || (strategy == LOCK_BAKERY && threads > BAKERY_MAX_THREADS)) {
+        fprintf(stderr, "%s: %s supports at most %d threads\n", argv[0], strategies[strategy].name,
+                strategy == LOCK_FILTER ? FILTER_MAX_THREADS : BAKERY_MAX_THREADS);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    // sw1 lets two writers into the sequence lock at once: the count may stay odd and stall the readers
+    if (readers && (strategy == LOCK_CAS || strategy == LOCK_SHARD
+                || strategy == LOCK_SW1 || strategy == LOCK_SW1_SCHED)) {
+        fprintf(stderr, "%s: -I needs the balance changed in a mutually exclusive critical section, not by %s\n",
+                argv[0], strategies[strategy].name);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (batch > 1 && (strategy == LOCK_CAS || strategy == LOCK_SHARD || strategy == LOCK_FC)) {
+        fprintf(stderr, "%s: -B applies to the lock strategies only\n", argv[0]);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    // the readers and the counters belong to threads, the pool workers are pinned by nobody
+    if (workers && (readers || counters || affinity != AFFINITY_NONE || fiber_workers)) {
+        fprintf(stderr, "%s: -T cannot be combined with -I, -c, -a or -X\n", argv[0]);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (fiber_workers && (readers || counters || affinity != AFFINITY_NONE)) {
+        fprintf(stderr, "%s: -X cannot be combined with -I, -c or -a\n", argv[0]);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (!fiber_workers && (strategy == LOCK_FMUTEX || strategy == LOCK_FSEM)) {
+        fprintf(stderr, "%s: %s waits as a fiber, it needs -X\n", argv[0], strategies[strategy].name);
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    // initialization
+
+    if (posix_memalign((void **) &tellers, CACHE_LINE, threads * sizeof(teller_t))) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    memset(tellers, 0, threads * sizeof(teller_t));
+    atexit(release_tellers);
+
+    if (readers) {
+        if (posix_memalign((void **) &inquirers, CACHE_LINE, readers * sizeof(reader_t))) {
+            perror("posix_memalign");
+            exit(EXIT_FAILURE);
+        }
+        memset(inquirers, 0, readers * sizeof(reader_t));
+    }
+
+    if (strategy == LOCK_SHARD) {
+        if (posix_memalign((void **) &shards, CACHE_LINE, threads * sizeof(shard_t))) {
+            perror("posix_memalign");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strategy == LOCK_FC) {
+        if (posix_memalign((void **) &fc_slots, CACHE_LINE, threads * sizeof(fc_slot_t))) {
+            perror("posix_memalign");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // the nodes of the CPUs, or the simulated ones
+    if (strategy == LOCK_COHORT) {
+        if (!topology.n)
+            topo_read(&topology);
+        if ((errno = cohort_init(&cohort, cohort_nodes ? cohort_nodes : topo_nodes(&topology), cohort_limit))) {
+            perror("cohort_init");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strategy == LOCK_FILTER)
+        filter_init(threads);
+    if (strategy == LOCK_BAKERY)
+        bakery_init(threads);
+
+    atexit(release_barrier);      // release resources at process exit
+
+    // initialize barrier with threshold threads + readers + 1 (the main thread included)
+    if (!workers && !fiber_workers) {
+        if ((errno = barrier_init(&barrier, barrier_type, threads + readers + 1))) {
+            perror("barrier_init");
+            exit(EXIT_FAILURE);
+        }
+        barrier_initialized = true;
+    }
+
+    // the ring holds the records of two groups and one waiting record of each teller
+    if (journal_path
+        && (errno = journal_open(&journal, journal_path, 2L * journal_group + threads, journal_group, flush_us * 1000))) {
+        perror(journal_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!seeded)
+        seed = getpid() * time(NULL);    // RNG init
+
+    // report the parameters
+    if (verbose)
+        printf("config strategy=%s threads=%d cpus=%d balance=%ld transactions=%ld max_withdraw=%d batch=%d"
+               " seed=%llu pregenerate=%d barrier=%s warmup=%d rounds=%d affinity=%s readers=%d ratio=%ld"
+               " journal=%s group=%d flush_us=%ld workers=%d fiber_workers=%d yield=%d\n",
+               strategies[strategy].name, threads, cpus, initial_amount, max_transactions, max_withdraw, batch,
+               seed, pregenerate, barrier_names[barrier_type], warmup, rounds, affinity_names[affinity],
+               readers, ratio, journal_path ? journal_path : "no", journal_group, flush_us, workers,
+               fiber_workers, yield_each);
+
+    if (histograms || journal_path)
+        ns_per_tick = tsc_ns_per_tick();    // calibrate before the measurement
+
+    if (workers) {
+        // the tellers as tasks: prepared here, submitted each round
+        for (i = 0; i < threads; ++i) {
+            tellers[i].id = i;
+            tellers[i].pinned = -1;
+            teller_setup(&tellers[i]);
+        }
+        if ((errno = pool_init(&pool, workers))) {
+            perror("pool_init");
+            exit(EXIT_FAILURE);
+        }
+    } else if (fiber_workers) {
+        // the tellers as fibers: prepared here, spawned each round
+        for (i = 0; i < threads; ++i) {
+            tellers[i].id = i;
+            tellers[i].pinned = -1;
+            teller_setup(&tellers[i]);
+        }
+        if ((errno = fiber_sched_init(&fibers, fiber_workers))) {
+            perror("fiber_sched_init");
+            exit(EXIT_FAILURE);
+        }
+        teller_stack = FIBER_STACK_SIZE;
+    } else {
+        // create threads, pinned to their CPUs if requested
+        if ((errno = pthread_attr_init(&attr))) {
+            perror("pthread_attr_init");
+            exit(EXIT_FAILURE);
+        }
+        pthread_attr_getstacksize(&attr, &teller_stack);
+        for (i = 0; i < threads; ++i) {
+            tellers[i].id = i;
+            tellers[i].pinned = affinity != AFFINITY_NONE ? cpu_order[i % cpu_count] : -1;
+            if (tellers[i].pinned >= 0 && (errno = topo_attr_pin(&attr, tellers[i].pinned))) {
+                perror("pthread_attr_setaffinity_np");
+                exit(EXIT_FAILURE);
+            }
+            if (pthread_create(&tellers[i].tid, &attr, do_withdrawals, &tellers[i])) {
+                fprintf(stderr, "ERROR creating thread %d\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+        // the readers take the CPUs following those of the tellers
+        for (i = 0; i < readers; ++i) {
+            inquirers[i].id = i;
+            inquirers[i].pinned = affinity != AFFINITY_NONE ? cpu_order[(threads + i) % cpu_count] : -1;
+            if (inquirers[i].pinned >= 0 && (errno = topo_attr_pin(&attr, inquirers[i].pinned))) {
+                perror("pthread_attr_setaffinity_np");
+                exit(EXIT_FAILURE);
+            }
+            if (pthread_create(&inquirers[i].tid, &attr, do_inquiries, &inquirers[i])) {
+                fprintf(stderr, "ERROR creating reader %d\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+        pthread_attr_destroy(&attr);
+
+        sync_threads(threads + readers);    // wait until the threads are ready
+    }
+
+    // the warmup rounds have negative numbers and are not reported
+    for (round = -warmup; round < rounds; ++round) {
+        reset_bank();
+        // the writer is idle: all the records of the previous round are durable
+        memset(&journal.stats, 0, sizeof(journal.stats));
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+        if (workers) {
+            // the round is over when the last teller task is done
+            for (i = 0; i < threads; ++i)
+                pool_submit(&pool, &round_wg, teller_task, &tellers[i]);
+            pool_wait(&pool, &round_wg);
+        } else if (fiber_workers) {
+            // the round is over when the last teller fiber has returned
+            for (i = 0; i < fiber_workers; ++i)
+                fibers.workers[i].switches = 0;
+            for (i = 0; i < threads; ++i)
+                if ((errno = fiber_spawn(&fibers, teller_fiber, &tellers[i]))) {
+                    perror("fiber_spawn");
+                    exit(EXIT_FAILURE);
+                }
+            if ((errno = fiber_sched_run(&fibers))) {
+                perror("fiber_sched_run");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            sync_threads(threads + readers);    // start the threads / odstartuj vlákna
+            sync_threads(threads + readers);    // wait for the threads to finish the round
+        }
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+
+        // reconcile the shards: the balance is what is left in them
+        if (strategy == LOCK_SHARD)
+            for (i = 0; i < threads; ++i)
+                balance += shards[i].balance;
+
+        if (round < 0)
+            continue;
+        if (!round && counters && !perf_valid(&tellers[0].perf, PERF_CYCLES))
+            fprintf(stderr, "%s: hardware performance counters not available, software events only\n", argv[0]);
+
+        throughput = report_round(round, &cpu_start, &cpu_end, ns_per_tick);
+        sum_throughput += throughput;
+        if (!round || throughput < min_throughput)
+            min_throughput = throughput;
+        if (!round || throughput > max_throughput)
+            max_throughput = throughput;
+    }
+
+    // wait for the threads termination
+    if (workers)
+        pool_destroy(&pool);
+    else if (fiber_workers)
+        fiber_sched_destroy(&fibers);
+    else
+        for (i = 0; i < threads; ++i) {
+            if (pthread_join(tellers[i].tid, NULL)) {
+                fprintf(stderr, "ERROR joining thread %d\n", i);
+                return EXIT_FAILURE;
+            }
+        }
+    for (i = 0; i < readers; ++i) {
+        if (pthread_join(inquirers[i].tid, NULL)) {
+            fprintf(stderr, "ERROR joining reader %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the journal holds all the records now
+    if (journal_path)
+        journal_close(&journal);
+
+    // round to round variation
+    if (rounds > 1)
+        printf("summary strategy=%s threads=%d rounds=%d throughput_mean=%.0f throughput_min=%.0f throughput_max=%.0f\n",
+               strategies[strategy].name, threads, rounds, sum_throughput / rounds, min_throughput, max_throughput);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+// Operating Systems: sample code
+// Threads
+// Barrier crossing cost
+//
+// All threads cross the barrier repeatedly without doing anything else, the time
+// per crossing is the cost of the barrier itself. The clock starts after one untimed
+// crossing, so the thread creation and start are not counted.
+//
+// usage: barrier_bench [-t threads] [-n crossings] [-Y barrier] [-q]
+//
+// The result is printed as a "key=value" record:
+//   result barrier=... threads=... crossings=... elapsed_s=... ns_per_crossing=...
+
+#define _GNU_SOURCE               // pthread barriers, posix_memalign(3)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "spin_barrier.h"          // reusable sense-reversing and tournament barriers
+#include "bench_opts.h"          // option parsing, elapsed time
+
+#define THREADS 4                  // default number of threads
+#define CROSSINGS 100000           // default number of crossings
+
+int threads = THREADS;
+long crossings = CROSSINGS;
+barrier_type_t barrier_type = BARRIER_PTHREAD;
+int verbose = 1;
+
+barrier_t barrier;
+struct timespec start, end;        // the timed crossings, taken by the participant 0
+
+// cross the barrier once, exit on error
+static void cross(int id) {
+    int rc;
+
+    if ((rc = barrier_wait(&barrier, id)) && rc != BARRIER_SERIAL_THREAD) {
+        errno = rc;
+        perror("barrier_wait");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// cross the barrier repeatedly, arg is the participant id
+void *do_crossings(void *arg) {
+    int id = (int) (long) arg;
+    long i;
+
+    // untimed: all participants exist and have started once it is crossed
+    cross(id);
+    if (id == 0)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < crossings; ++i)
+        cross(id);
+    if (id == 0)
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    return NULL;
+}
+
+// print usage and exit
+static void usage(const char *prog, int status) {
+    fprintf(status ? stderr : stdout,
+            "usage: %s [-t threads] [-n crossings] [-Y barrier] [-q]\n"
+            "  -t threads       the number of threads (default: %d)\n"
+            "  -n crossings     barrier crossings per thread (default: %d)\n"
+            "  -Y barrier       pthread, sr (sense-reversing), tree (default: pthread)\n"
+            "  -q               print the result record only\n",
+            prog, THREADS, CROSSINGS);
+    exit(status);
+}
+
+// find the barrier type by its name, exit on error
+static barrier_type_t parse_barrier(const char *prog, const char *name) {
+    int b;
+
+    for (b = 0; b < BARRIER_TYPES; ++b)
+        if (!strcmp(name, barrier_names[b]))
+            return b;
+    fprintf(stderr, "%s: unknown barrier: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return BARRIER_TYPES;    // not reached
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    long i;
+    pthread_t *tids;
+    double elapsed;
+
+    // options
+    while ((opt = getopt(argc, argv, "t:n:Y:qh")) != -1) {
+        switch (opt) {
+            case 't':
+                threads = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'n':
+                crossings = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'Y':
+                barrier_type = parse_barrier(argv[0], optarg);
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+            default:
+                usage(argv[0], EXIT_FAILURE);
+        }
+    }
+
+    if (!(tids = malloc(threads * sizeof(pthread_t)))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    // the main thread is the participant 0
+    if ((errno = barrier_init(&barrier, barrier_type, threads))) {
+        perror("barrier_init");
+        exit(EXIT_FAILURE);
+    }
+
+    if (verbose)
+        printf("config barrier=%s threads=%d crossings=%ld cpus=%ld\n",
+               barrier_names[barrier_type], threads, crossings, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (i = 1; i < threads; ++i)
+        if (pthread_create(&tids[i], NULL, do_crossings, (void *) i)) {
+            fprintf(stderr, "ERROR creating thread %ld\n", i);
+            return EXIT_FAILURE;
+        }
+    do_crossings((void *) 0L);
+
+    for (i = 1; i < threads; ++i)
+        if (pthread_join(tids[i], NULL)) {
+            fprintf(stderr, "ERROR joining thread %ld\n", i);
+            return EXIT_FAILURE;
+        }
+
+    elapsed = elapsed_seconds(&start, &end);
+    printf("result barrier=%s threads=%d crossings=%ld elapsed_s=%.6f ns_per_crossing=%.1f\n",
+           barrier_names[barrier_type], threads, crossings, elapsed, elapsed * 1e9 / crossings);
+
+    if ((errno = barrier_destroy(&barrier)))
+        perror("barrier_destroy");
+    free(tids);
+    return EXIT_SUCCESS;
+}
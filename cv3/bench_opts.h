@@ -0,0 +1,98 @@
+// Operating Systems: sample code
+// Threads
+// Benchmark helpers: option argument parsing, elapsed time
+//
+// The benchmarks parse their numeric options the same way: the whole argument must be
+// a number (decimal, 0x hexadecimal or 0 octal) in the allowed range, otherwise the
+// program prints the error and its usage and exits. The program defines usage(), the
+// parsers call it with EXIT_FAILURE.
+//
+// usage:
+//
+// #include "bench_opts.h"
+//
+// static void usage(const char *prog, int status) { ...; exit(status); }
+//
+// threads = parse_positive(argv[0], opt, optarg);	// 1 and more
+// warmup = parse_nonnegative(argv[0], opt, optarg);	// 0 and more
+// seed = parse_seed(argv[0], opt, optarg);		// any unsigned number
+// elapsed = elapsed_seconds(&start, &end);
+
+#ifndef BENCH_OPTS_H
+#define BENCH_OPTS_H
+
+#include <stdio.h>
+#include <stdlib.h>			// strtol(3), strtoull(3)
+#include <errno.h>
+#include <time.h>			// struct timespec
+
+// print the usage of the program and exit with the status, defined by the program
+static void usage(const char *prog, int status);
+
+// parse a positive number option argument, exit on error
+static inline
+long parse_positive(const char *prog, int opt, const char *arg);
+
+// parse a non-negative number option argument, exit on error
+static inline
+long parse_nonnegative(const char *prog, int opt, const char *arg);
+
+// parse a seed option argument (any unsigned number), exit on error
+static inline
+unsigned long long parse_seed(const char *prog, int opt, const char *arg);
+
+// time difference in seconds
+static inline
+double elapsed_seconds(const struct timespec *start, const struct timespec *end);
+
+
+// a number of at least min
+static inline
+long parse_at_least(const char *prog, int opt, const char *arg, long min)
+{
+	char *end;
+	long value;
+
+	errno = 0;
+	value = strtol(arg, &end, 0);
+	if (errno || end == arg || *end || value < min) {
+		fprintf(stderr, "%s: invalid argument of -%c: %s\n", prog, opt, arg);
+		usage(prog, EXIT_FAILURE);
+	}
+	return value;
+}
+
+// positive
+long parse_positive(const char *prog, int opt, const char *arg)
+{
+	return parse_at_least(prog, opt, arg, 1);
+}
+
+// non-negative
+long parse_nonnegative(const char *prog, int opt, const char *arg)
+{
+	return parse_at_least(prog, opt, arg, 0);
+}
+
+// seed
+unsigned long long parse_seed(const char *prog, int opt, const char *arg)
+{
+	char *end;
+	unsigned long long value;
+
+	errno = 0;
+	value = strtoull(arg, &end, 0);
+	if (errno || end == arg || *end) {
+		fprintf(stderr, "%s: invalid argument of -%c: %s\n", prog, opt, arg);
+		usage(prog, EXIT_FAILURE);
+	}
+	return value;
+}
+
+// elapsed time
+double elapsed_seconds(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+#endif // BENCH_OPTS_H
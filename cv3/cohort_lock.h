@@ -0,0 +1,133 @@
+// Operating Systems: sample code
+// Critical Sections
+// HW method: NUMA-aware cohort lock (Dice, Marathe, Shavit: "Lock Cohorting")
+//
+// A simple lock used by threads on all packages (NUMA nodes) moves its cache line
+// between the packages on nearly every acquisition, and the protected data follow.
+// The cohort lock has one global lock and one local lock per node. A thread takes the
+// local lock of its node first and then the global one, unless the previous owner
+// from the same node has passed the global lock to it: on release, an owner with
+// local waiters keeps the global lock for its node and releases the local lock only.
+// The lock and the data stay in the node for a batch of acquisitions; after
+// COHORT_PASS_LIMIT passes in a row the global lock is released so that the other
+// nodes are not starved.
+//
+// Both locks are ticket locks: the global one may be released by another thread than
+// the one which acquired it (a thread-oblivious lock), the local one tells whether
+// anybody is waiting (cohort detection). The node of a thread is its NUMA node or
+// any grouping of the CPUs; a wrong node costs performance, not correctness.
+//
+// usage:
+//
+// #include "cohort_lock.h"
+//
+// cohort_lock_t lock;
+//
+// cohort_init(&lock, nodes, COHORT_PASS_LIMIT);
+// cohort_lock(&lock, node);	// 0 to nodes - 1
+// // critical section
+// cohort_unlock(&lock, node);	// the node it was locked with
+// cohort_destroy(&lock);
+
+#ifndef COHORT_LOCK_H
+#define COHORT_LOCK_H
+
+#include <stdbool.h>
+#include <stdlib.h>			// posix_memalign(3)
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include "ticket_lock.h"		// FIFO ticket lock
+
+// the default number of passes within a node before the global lock is released
+#ifndef COHORT_PASS_LIMIT
+#	define COHORT_PASS_LIMIT	(1<<6)
+#endif
+
+// the local part of one node, on its own cache line
+typedef struct {
+	ticket_lock_t local;		// the threads of this node
+	bool global_owned;		// the global lock was passed with the local one
+	int passes;			// passes in a row, under the local lock
+	long acquired;			// global lock acquisitions by this node
+	long passed;			// acquisitions passed within the node
+} __attribute__ ((aligned(64))) cohort_node_t;
+
+// cohort lock data
+typedef struct {
+	ticket_lock_t global __attribute__ ((aligned(64)));	// the owning node
+	int nodes;
+	int limit;			// the maximum passes in a row
+	cohort_node_t *node;
+} cohort_lock_t;
+
+// initialize the lock for the nodes, return 0 or an error number
+static inline
+int cohort_init(cohort_lock_t *lock, int nodes, int limit);
+
+// release the nodes
+static inline
+void cohort_destroy(cohort_lock_t *lock);
+
+// acquire the lock from the node
+__attribute__ ((always_inline)) static inline
+void cohort_lock(cohort_lock_t *lock, int node);
+
+// release the lock, the node it was acquired from
+__attribute__ ((always_inline)) static inline
+void cohort_unlock(cohort_lock_t *lock, int node);
+
+
+// initialize the lock: all unlocked
+int cohort_init(cohort_lock_t *lock, int nodes, int limit)
+{
+	if (nodes <= 0)
+		return EINVAL;
+	if (posix_memalign((void **) &lock->node, 64, nodes * sizeof(cohort_node_t)))
+		return ENOMEM;
+	memset(lock->node, 0, nodes * sizeof(cohort_node_t));
+	lock->global.next = lock->global.owner = 0;
+	lock->nodes = nodes;
+	lock->limit = limit;
+	return 0;
+}
+
+// release the lock data
+void cohort_destroy(cohort_lock_t *lock)
+{
+	free(lock->node);
+	lock->node = NULL;
+}
+
+// acquire the lock
+void cohort_lock(cohort_lock_t *lock, int node)
+{
+	cohort_node_t *n = &lock->node[node];
+
+	ticket_lock(&n->local);
+	// the previous owner from this node may have kept the global lock for us
+	if (n->global_owned)
+		++n->passed;
+	else {
+		ticket_lock(&lock->global);
+		n->global_owned = true;
+		++n->acquired;
+	}
+}
+
+// release the lock
+void cohort_unlock(cohort_lock_t *lock, int node)
+{
+	cohort_node_t *n = &lock->node[node];
+
+	// a local waiter has taken a ticket: pass it the global lock too, up to the limit
+	if (__atomic_load_n(&n->local.next, __ATOMIC_RELAXED) - n->local.owner > 1 && n->passes < lock->limit)
+		++n->passes;
+	else {
+		n->passes = 0;
+		n->global_owned = false;
+		ticket_unlock(&lock->global);
+	}
+	ticket_unlock(&n->local);
+}
+
+#endif // COHORT_LOCK_H
@@ -0,0 +1,284 @@
+// Operating Systems: sample code
+// Threads
+// CPU topology and thread placement
+//
+// The topology is read from /sys/devices/system/cpu: the online CPUs and for each
+// one its package (socket), core and the position among its SMT siblings
+// (hyperthreads), and its NUMA node. Only the CPUs allowed to the process (taskset, cgroups) are used.
+// The placement policy orders the CPUs, thread i is pinned to the CPU i modulo the
+// number of CPUs:
+//   compact   one thread per core, fill a package before the next one, SMT siblings last
+//   scatter   one thread per core, round robin over the packages, SMT siblings last
+//   smt       fill all SMT siblings of a core before the next core
+//   list      the given CPUs in the given order, e.g. "0,2,4-7"
+//
+// usage:
+//
+// #define _GNU_SOURCE		// CPU_SET(3), pthread_attr_setaffinity_np(3)
+// #include "cpu_topology.h"
+//
+// cpu_topology_t topo;
+// int order[CPU_MAX];
+//
+// topo_read(&topo);
+// n = topo_order(&topo, AFFINITY_SCATTER, order);	// or topo_parse_list("0,2,4-7", order, CPU_MAX)
+// topo_attr_pin(&attr, order[i % n]);			// attributes for pthread_create()
+
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <stdio.h>
+#include <stdlib.h>			// strtol(3), qsort(3)
+#include <string.h>
+#include <sched.h>			// sched_getaffinity(2), CPU_SET(3)
+#include <dirent.h>			// opendir(3), readdir(3)
+#include <pthread.h>
+
+// the maximal number of CPUs
+#define CPU_MAX		1024
+
+#define SYS_CPU		"/sys/devices/system/cpu"
+
+// placement policies
+typedef enum {
+	AFFINITY_NONE,			// not pinned, the scheduler decides
+	AFFINITY_COMPACT,
+	AFFINITY_SCATTER,
+	AFFINITY_SMT,
+	AFFINITY_LIST,			// explicit list of CPUs
+	AFFINITY_POLICIES		// the number of policies
+} affinity_t;
+
+static const char *affinity_names[AFFINITY_POLICIES] __attribute__ ((unused)) = {
+	[AFFINITY_NONE]		= "none",
+	[AFFINITY_COMPACT]	= "compact",
+	[AFFINITY_SCATTER]	= "scatter",
+	[AFFINITY_SMT]		= "smt",
+	[AFFINITY_LIST]		= "list",
+};
+
+// one logical CPU
+typedef struct {
+	int cpu;			// the CPU number
+	int package;			// physical package (socket) id
+	int core;			// core id, unique within the package only
+	int core_rank;			// the core number within the package: 0, 1, ...
+	int smt;			// the position among the SMT siblings of the core: 0, 1, ...
+	int node;			// NUMA node, the package if not known
+} cpu_info_t;
+
+typedef struct {
+	int n;				// the number of usable CPUs
+	cpu_info_t cpus[CPU_MAX];
+} cpu_topology_t;
+
+
+// parse a CPU list like "0-3,8,10-11" into cpus[], return the count or -1 on error
+static inline
+int topo_parse_list(const char *s, int *cpus, int max)
+{
+	char *end;
+	long first, last;
+	int n = 0;
+
+	while (*s && *s != '\n') {
+		first = last = strtol(s, &end, 10);
+		if (end == s || first < 0)
+			return -1;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first)
+				return -1;
+		}
+		if (last >= CPU_MAX)
+			return -1;
+		for (; first <= last; ++first) {
+			if (n == max)
+				return -1;
+			cpus[n++] = first;
+		}
+		s = end;
+		if (*s == ',')
+			++s;
+		else if (*s && *s != '\n')
+			return -1;
+	}
+	return n;
+}
+
+// read one number from the topology directory of the CPU, -1 if not available
+static inline
+int topo_read_int(int cpu, const char *name)
+{
+	char path[128];
+	FILE *f;
+	int value = -1;
+
+	snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/%s", cpu, name);
+	if ((f = fopen(path, "r"))) {
+		if (fscanf(f, "%d", &value) != 1)
+			value = -1;
+		fclose(f);
+	}
+	return value;
+}
+
+// the NUMA node of the CPU: its directory has a nodeN link, -1 if not available
+static inline
+int topo_read_node(int cpu)
+{
+	char path[128];
+	DIR *dir;
+	struct dirent *e;
+	int node = -1;
+
+	snprintf(path, sizeof(path), SYS_CPU "/cpu%d", cpu);
+	if ((dir = opendir(path))) {
+		while (node < 0 && (e = readdir(dir)))
+			if (sscanf(e->d_name, "node%d", &node) != 1)
+				node = -1;
+		closedir(dir);
+	}
+	return node;
+}
+
+// read the topology of the online CPUs allowed to the process, return their count
+static inline
+int topo_read(cpu_topology_t *topo)
+{
+	char line[4096];
+	int online[CPU_MAX];
+	int n = -1;
+	int i, j;
+	cpu_set_t allowed;
+	cpu_info_t *c;
+	FILE *f;
+
+	if ((f = fopen(SYS_CPU "/online", "r"))) {
+		if (fgets(line, sizeof(line), f))
+			n = topo_parse_list(line, online, CPU_MAX);
+		fclose(f);
+	}
+	if (n <= 0) {			// no sysfs: CPU 0 only
+		online[0] = 0;
+		n = 1;
+	}
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		CPU_ZERO(&allowed);
+
+	topo->n = 0;
+	for (i = 0; i < n; ++i) {
+		if (CPU_COUNT(&allowed) && !CPU_ISSET(online[i], &allowed))
+			continue;
+		c = &topo->cpus[topo->n++];
+		c->cpu = online[i];
+		// missing topology (some virtual machines, containers): each CPU is a core
+		if ((c->package = topo_read_int(c->cpu, "physical_package_id")) < 0)
+			c->package = 0;
+		if ((c->core = topo_read_int(c->cpu, "core_id")) < 0)
+			c->core = c->cpu;
+		if ((c->node = topo_read_node(c->cpu)) < 0)
+			c->node = c->package;
+	}
+
+	// the position among the siblings: by the CPU numbers within the core
+	for (i = 0; i < topo->n; ++i) {
+		c = &topo->cpus[i];
+		c->smt = 0;
+		for (j = 0; j < topo->n; ++j)
+			if (topo->cpus[j].package == c->package && topo->cpus[j].core == c->core
+			    && topo->cpus[j].cpu < c->cpu)
+				++c->smt;
+	}
+	// the core rank: the number of distinct cores with a lower id in the package
+	for (i = 0; i < topo->n; ++i) {
+		c = &topo->cpus[i];
+		c->core_rank = 0;
+		for (j = 0; j < topo->n; ++j)
+			if (topo->cpus[j].package == c->package && topo->cpus[j].core < c->core
+			    && !topo->cpus[j].smt)
+				++c->core_rank;
+	}
+	return topo->n;
+}
+
+// the policy for topo_compare(), qsort(3) passes no context
+static affinity_t topo_sort_policy;
+
+// compare two CPUs by the keys of the placement policy
+static inline
+int topo_compare(const void *pa, const void *pb)
+{
+	const cpu_info_t *a = pa, *b = pb;
+	int ka[3], kb[3];
+	int k;
+
+	switch (topo_sort_policy) {
+	case AFFINITY_SMT:		// siblings, cores, packages
+		ka[0] = a->package;	ka[1] = a->core_rank;	ka[2] = a->smt;
+		kb[0] = b->package;	kb[1] = b->core_rank;	kb[2] = b->smt;
+		break;
+	case AFFINITY_SCATTER:		// packages, cores, siblings
+		ka[0] = a->smt;		ka[1] = a->core_rank;	ka[2] = a->package;
+		kb[0] = b->smt;		kb[1] = b->core_rank;	kb[2] = b->package;
+		break;
+	default:			// compact: cores, packages, siblings
+		ka[0] = a->smt;		ka[1] = a->package;	ka[2] = a->core_rank;
+		kb[0] = b->smt;		kb[1] = b->package;	kb[2] = b->core_rank;
+	}
+	for (k = 0; k < 3; ++k)
+		if (ka[k] != kb[k])
+			return ka[k] < kb[k] ? -1 : 1;
+	return a->cpu - b->cpu;
+}
+
+// order the CPUs by the policy into order[] (CPU numbers), return their count
+static inline
+int topo_order(cpu_topology_t *topo, affinity_t policy, int *order)
+{
+	int i;
+
+	topo_sort_policy = policy;
+	qsort(topo->cpus, topo->n, sizeof(cpu_info_t), topo_compare);
+	for (i = 0; i < topo->n; ++i)
+		order[i] = topo->cpus[i].cpu;
+	return topo->n;
+}
+
+// find the CPU in the topology, NULL if it is not usable
+static inline
+const cpu_info_t *topo_find(const cpu_topology_t *topo, int cpu)
+{
+	int i;
+
+	for (i = 0; i < topo->n; ++i)
+		if (topo->cpus[i].cpu == cpu)
+			return &topo->cpus[i];
+	return NULL;
+}
+
+// the number of NUMA nodes: the highest node number + 1
+static inline
+int topo_nodes(const cpu_topology_t *topo)
+{
+	int i, nodes = 1;
+
+	for (i = 0; i < topo->n; ++i)
+		if (topo->cpus[i].node >= nodes)
+			nodes = topo->cpus[i].node + 1;
+	return nodes;
+}
+
+// set the thread attributes to pin the thread to the CPU, return 0 or an error number
+static inline
+int topo_attr_pin(pthread_attr_t *attr, int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+#endif // CPU_TOPOLOGY_H
@@ -0,0 +1,338 @@
+// Operating Systems: sample code
+// Threads
+// Account directory lookups while a writer inserts: RCU style against a rwlock
+//
+// The directory (account_dir.h) starts with the given number of accounts and a small
+// table. The reader threads look up random accounts among those inserted so far while
+// one writer thread inserts new accounts, with -x also retiring the oldest ones, so
+// the table is resized several times and the retired nodes are reclaimed meanwhile.
+// The modes:
+//   rcu      the readers use epoch sections only: no lock, no shared write
+//   rwlock   the same table behind a pthread_rwlock_t, read-locked for each lookup,
+//            write-locked for each insert or retirement
+// A read lock writes to the lock word, so the readers contend on its cache line even
+// when the writer is idle; the epoch section writes to the reader's own line only.
+// The rwlock prefers the writer: with the default preference of the readers a stream
+// of lookups would keep the writer out for ever.
+//
+// usage: dir_bench [-m mode] [-t readers] [-n accounts] [-i inserts] [-b buckets] [-x] [-s seed] [-q]
+//
+// Results are printed as "key=value" records:
+//   reader ...   lookups and hits of each reader
+//   result mode=... readers=... lookups=... lookup_throughput=... ns_per_lookup=...
+//          insert_throughput=... resizes=... epochs=... retired=... freed=...
+
+#define _GNU_SOURCE               // posix_memalign(3), pthread_rwlockattr_setkind_np(3)
+
+#include <stdio.h>
+#include <stdlib.h>            // strtol(3), strtoull(3)
+#include <string.h>            // strcmp(3), memset(3)
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>            // getpid(), getopt(3)
+#include <time.h>              // time(2), clock_gettime(2)
+#include <pthread.h>
+#include "account_dir.h"          // hash table with lock-free lookups, epoch reclamation
+#include "rng.h"          // per-thread xorshift64* generator
+#include "spin_barrier.h"          // synchronous start
+#include "bench_opts.h"          // option parsing, elapsed time
+
+#define READERS 4                  // default number of reader threads
+#define ACCOUNTS (1<<16)           // default initial number of accounts
+#define INSERTS (1<<16)            // default accounts inserted by the writer
+#define BUCKETS (1<<10)            // default initial table size
+#define INITIAL_BALANCE 1000       // the balance of a new account
+
+#define CACHE_LINE 64              // cache line size, used to avoid false sharing
+
+// benchmark modes
+typedef enum {
+    MODE_RCU,            // epoch sections, no locks
+    MODE_RWLOCK,            // reader-writer lock around each operation
+    MODES                   // the number of modes
+} dir_mode_t;
+
+static const char *mode_names[MODES] = {
+    [MODE_RCU]    = "rcu",
+    [MODE_RWLOCK] = "rwlock",
+};
+
+// per-reader data, each reader on its own cache line
+typedef struct {
+    int id;                // reader number
+    pthread_t tid;            // thread ID
+    long lookups;            // accounts looked up
+    long hits;                // of them found
+    long sum;                // the sum of the balances found, keeps the reads alive
+    struct timespec start;        // the time the reader started
+    struct timespec end;        // the time the reader stopped
+} __attribute__((aligned(CACHE_LINE))) reader_t;
+
+dir_mode_t mode = MODE_RCU;
+int readers = READERS;
+long accounts = ACCOUNTS;
+long inserts = INSERTS;
+long buckets = BUCKETS;
+bool retire = false;            // the writer retires the oldest account after each insert
+unsigned long long seed;        // RNG seed, each reader has its own stream
+int verbose = 1;
+
+account_dir_t dir;
+pthread_rwlock_t rwlock;        // the rwlock mode, writers preferred
+volatile long inserted;            // ids below are inserted (or were and are retired)
+volatile bool writer_done = false;    // stops the readers
+reader_t *reader_data = NULL;
+struct timespec write_start, write_end;
+
+barrier_t barrier;            // synchronous start
+
+// synchronize all threads: the readers, then the writer, the main thread is the last one
+static void sync_threads(int id) {
+    int rc;
+
+    if ((rc = barrier_wait(&barrier, id)) && rc != BARRIER_SERIAL_THREAD) {
+        errno = rc;
+        perror("barrier_wait");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// add the account, exit on error
+static void insert(long id) {
+    if (mode == MODE_RWLOCK)
+        pthread_rwlock_wrlock(&rwlock);
+    if ((errno = dir_insert(&dir, id, INITIAL_BALANCE))) {
+        perror("dir_insert");
+        exit(EXIT_FAILURE);
+    }
+    if (mode == MODE_RWLOCK)
+        pthread_rwlock_unlock(&rwlock);
+}
+
+// a reader: look up random accounts among the inserted ones until the writer is done
+void *do_lookups(void *arg) {
+    reader_t *self = arg;
+    account_t *a;
+    rng_t rng;
+    long id;
+
+    rng_seed(&rng, seed, self->id);
+    sync_threads(self->id);
+    clock_gettime(CLOCK_MONOTONIC, &self->start);
+
+    while (!__atomic_load_n(&writer_done, __ATOMIC_RELAXED)) {
+        id = rng_next(&rng) % __atomic_load_n(&inserted, __ATOMIC_RELAXED);
+        if (mode == MODE_RWLOCK) {
+            pthread_rwlock_rdlock(&rwlock);
+            if ((a = dir_lookup(&dir, id))) {
+                ++self->hits;
+                self->sum += a->balance;
+            }
+            pthread_rwlock_unlock(&rwlock);
+        } else {
+            dir_read_begin(&dir, self->id);
+            if ((a = dir_lookup(&dir, id))) {
+                ++self->hits;
+                self->sum += a->balance;
+            }
+            dir_read_end(&dir, self->id);
+        }
+        ++self->lookups;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &self->end);
+    return NULL;
+}
+
+// the writer: insert the new accounts, retire the oldest ones with -x
+void *do_inserts(void *arg) {
+    long id;
+    int rc;
+
+    sync_threads(readers);
+    clock_gettime(CLOCK_MONOTONIC, &write_start);
+
+    for (id = accounts; id < accounts + inserts; ++id) {
+        insert(id);
+        __atomic_store_n(&inserted, id + 1, __ATOMIC_RELAXED);
+        if (retire) {
+            if (mode == MODE_RWLOCK)
+                pthread_rwlock_wrlock(&rwlock);
+            if ((rc = dir_retire(&dir, id - accounts)))
+                fprintf(stderr, "dir_retire %ld: %s\n", id - accounts, strerror(rc));
+            if (mode == MODE_RWLOCK)
+                pthread_rwlock_unlock(&rwlock);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &write_end);
+    __atomic_store_n(&writer_done, true, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// print usage and exit
+static void usage(const char *prog, int status) {
+    fprintf(status ? stderr : stdout,
+            "usage: %s [-m mode] [-t readers] [-n accounts] [-i inserts] [-b buckets] [-x] [-s seed] [-q]\n"
+            "  -m mode          rcu, rwlock (default: rcu)\n"
+            "  -t readers       the number of reader threads (default: %d)\n"
+            "  -n accounts      accounts before the start (default: %d)\n"
+            "  -i inserts       accounts inserted by the writer (default: %d)\n"
+            "  -b buckets       initial table size, rounded up to a power of two (default: %d)\n"
+            "  -x               retire the oldest account after each insert\n"
+            "  -s seed          RNG seed (default: random)\n"
+            "  -q               print the result record only\n",
+            prog, READERS, ACCOUNTS, INSERTS, BUCKETS);
+    exit(status);
+}
+
+// find the mode by its name, exit on error
+static dir_mode_t parse_mode(const char *prog, const char *name) {
+    int m;
+
+    for (m = 0; m < MODES; ++m)
+        if (!strcmp(name, mode_names[m]))
+            return m;
+    fprintf(stderr, "%s: unknown mode: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return MODES;    // not reached
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    int i;
+    long id, b = 1;
+    long total_lookups = 0, total_hits = 0, missing = 0, stale = 0;
+    double reader_time = 0, write_elapsed;
+    bool seeded = false;
+    pthread_t writer;
+    pthread_rwlockattr_t rwattr;
+
+    // options
+    while ((opt = getopt(argc, argv, "m:t:n:i:b:xs:qh")) != -1) {
+        switch (opt) {
+            case 'm':
+                mode = parse_mode(argv[0], optarg);
+                break;
+            case 't':
+                readers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'n':
+                accounts = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'i':
+                inserts = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'b':
+                buckets = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'x':
+                retire = true;
+                break;
+            case 's':
+                seed = parse_seed(argv[0], opt, optarg);
+                seeded = true;
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+            default:
+                usage(argv[0], EXIT_FAILURE);
+        }
+    }
+    while (b < buckets)
+        b <<= 1;
+    buckets = b;
+    if (retire && inserts > accounts) {
+        fprintf(stderr, "%s: -x retires the initial accounts, at most %ld inserts\n", argv[0], accounts);
+        usage(argv[0], EXIT_FAILURE);
+    }
+    if (!seeded)
+        seed = getpid() * time(NULL);    // RNG init
+
+    if (verbose)
+        printf("config mode=%s readers=%d accounts=%ld inserts=%ld buckets=%ld retire=%d seed=%llu cpus=%ld\n",
+               mode_names[mode], readers, accounts, inserts, buckets, retire, seed,
+               sysconf(_SC_NPROCESSORS_ONLN));
+
+    pthread_rwlockattr_init(&rwattr);
+    pthread_rwlockattr_setkind_np(&rwattr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    if ((errno = pthread_rwlock_init(&rwlock, &rwattr))) {
+        perror("pthread_rwlock_init");
+        exit(EXIT_FAILURE);
+    }
+    pthread_rwlockattr_destroy(&rwattr);
+
+    // the directory with the initial accounts, the readers of the rwlock mode need no epochs
+    if ((errno = dir_init(&dir, buckets, mode == MODE_RCU ? readers : 0))) {
+        perror("dir_init");
+        exit(EXIT_FAILURE);
+    }
+    for (id = 0; id < accounts; ++id)
+        insert(id);
+    inserted = accounts;
+
+    if (posix_memalign((void **) &reader_data, CACHE_LINE, readers * sizeof(reader_t))) {
+        perror("posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    memset(reader_data, 0, readers * sizeof(reader_t));
+    // the readers, the writer and the main thread
+    if ((errno = barrier_init(&barrier, BARRIER_PTHREAD, readers + 2))) {
+        perror("barrier_init");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < readers; ++i) {
+        reader_data[i].id = i;
+        if ((errno = pthread_create(&reader_data[i].tid, NULL, do_lookups, &reader_data[i]))) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((errno = pthread_create(&writer, NULL, do_inserts, NULL))) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    sync_threads(readers + 1);    // start the threads / odstartuj vlákna
+
+    pthread_join(writer, NULL);
+    for (i = 0; i < readers; ++i) {
+        pthread_join(reader_data[i].tid, NULL);
+        total_lookups += reader_data[i].lookups;
+        total_hits += reader_data[i].hits;
+        reader_time += elapsed_seconds(&reader_data[i].start, &reader_data[i].end);
+        if (verbose)
+            printf("reader id=%d lookups=%ld hits=%ld elapsed_s=%.6f\n", i, reader_data[i].lookups,
+                   reader_data[i].hits, elapsed_seconds(&reader_data[i].start, &reader_data[i].end));
+    }
+    write_elapsed = elapsed_seconds(&write_start, &write_end);
+
+    // the directory must hold exactly the accounts not retired, no other thread runs now
+    for (id = 0; id < accounts + inserts; ++id) {
+        if (dir_lookup(&dir, id))
+            stale += retire && id < inserts;
+        else
+            missing += !(retire && id < inserts);
+    }
+
+    printf("result mode=%s readers=%d accounts=%ld inserts=%ld retire=%d elapsed_s=%.6f lookups=%ld hits=%ld"
+           " lookup_throughput=%.0f ns_per_lookup=%.2f insert_throughput=%.0f resizes=%ld buckets=%lu"
+           " epochs=%lu retired=%ld freed=%ld missing=%ld stale=%ld\n",
+           mode_names[mode], readers, accounts, inserts, retire, write_elapsed, total_lookups, total_hits,
+           write_elapsed > 0 ? total_lookups / write_elapsed : 0.0,
+           total_lookups ? reader_time * 1e9 / total_lookups : 0.0,
+           write_elapsed > 0 ? inserts / write_elapsed : 0.0, dir.resizes, dir.table->mask + 1,
+           dir.ebr.epoch, dir.ebr.retired, dir.ebr.freed, missing, stale);
+    if (missing || stale)
+        fprintf(stderr, "DIRECTORY INCONSISTENT: %ld accounts missing, %ld retired accounts found\n",
+                missing, stale);
+
+    barrier_destroy(&barrier);
+    pthread_rwlock_destroy(&rwlock);
+    dir_destroy(&dir);
+    free(reader_data);
+    return EXIT_SUCCESS;
+}
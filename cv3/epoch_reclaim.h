@@ -0,0 +1,209 @@
+// Operating Systems: sample code
+// Threads
+// Epoch-based reclamation: freeing memory that lock-free readers may still use
+//
+// A writer which unlinks a node from a structure read without locks cannot free it
+// at once: a reader may have loaded the pointer just before and still use it. Here
+// each reader announces the global epoch in its own slot (one cache line, written by
+// the reader only) while it is inside a read-side section, and clears it when it
+// leaves. A retired node is tagged with the epoch of its retirement; the epoch may
+// advance only when every reader inside a section has announced the current one.
+// Two advances after the retirement, all the readers that could have seen the node
+// have left their sections and the node is freed (the grace period of RCU).
+//
+// The readers never wait and write nothing shared. The writers must be serialized
+// by the caller (ebr_retire() and ebr_reclaim() are not thread-safe); a reader staying
+// in a section forever only delays the reclamation.
+//
+// usage:
+//
+// #include "epoch_reclaim.h"
+//
+// ebr_t ebr;
+//
+// ebr_init(&ebr, readers);
+// // reader id:
+// ebr_enter(&ebr, id);
+// p = __atomic_load_n(&shared, __ATOMIC_ACQUIRE);	// use *p
+// ebr_exit(&ebr, id);
+// // the writer:
+// old = shared; __atomic_store_n(&shared, new, __ATOMIC_RELEASE);
+// ebr_retire(&ebr, old, free);			// freed after a grace period
+// ebr_destroy(&ebr);				// frees all retired nodes
+
+#ifndef EPOCH_RECLAIM_H
+#define EPOCH_RECLAIM_H
+
+#include <stdbool.h>
+#include <stdlib.h>			// malloc(3), posix_memalign(3)
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include <sched.h>			// sched_yield(2)
+
+// retirements between the attempts to advance the epoch and free
+#ifndef EBR_RECLAIM_BATCH
+#	define EBR_RECLAIM_BATCH	(1<<6)
+#endif
+
+// the announcement of one reader, on its own cache line
+typedef struct {
+	volatile unsigned long state;	// epoch << 1 | 1 inside a section, 0 outside
+} __attribute__ ((aligned(64))) ebr_slot_t;
+
+// a retired node waiting for its grace period
+typedef struct ebr_retired {
+	void *ptr;
+	void (*release)(void *);	// how to free it
+	unsigned long epoch;		// the epoch of the retirement
+	struct ebr_retired *next;
+} ebr_retired_t;
+
+// reclamation data
+typedef struct {
+	volatile unsigned long epoch __attribute__ ((aligned(64)));	// the global epoch
+	int readers;
+	ebr_slot_t *slots;
+	// the writer only
+	ebr_retired_t *limbo;		// retired, the newest first
+	long pending;			// retired, not freed yet
+	long since;			// retired since the last attempt to reclaim
+	long retired;			// statistics: all retired nodes
+	long freed;			// statistics: nodes freed after their grace period
+} ebr_t;
+
+// initialize for the given number of readers (ids 0 to readers - 1), return 0 or an error number
+static inline
+int ebr_init(ebr_t *e, int readers);
+
+// free all the retired nodes and the slots, no reader may be in a section
+static inline
+void ebr_destroy(ebr_t *e);
+
+// enter a read-side section: the pointers loaded from now on stay valid
+__attribute__ ((always_inline)) static inline
+void ebr_enter(ebr_t *e, int id);
+
+// leave the read-side section
+__attribute__ ((always_inline)) static inline
+void ebr_exit(ebr_t *e, int id);
+
+// free the unlinked node after a grace period, by the writer only
+static inline
+void ebr_retire(ebr_t *e, void *ptr, void (*release)(void *));
+
+// advance the epoch if possible and free the nodes past their grace period, by the writer only
+static inline
+void ebr_reclaim(ebr_t *e);
+
+
+// initialize: epoch 0, all readers outside
+int ebr_init(ebr_t *e, int readers)
+{
+	memset(e, 0, sizeof(*e));
+	if (readers > 0 && posix_memalign((void **) &e->slots, 64, readers * sizeof(ebr_slot_t)))
+		return ENOMEM;
+	if (readers > 0)
+		memset(e->slots, 0, readers * sizeof(ebr_slot_t));
+	e->readers = readers;
+	return 0;
+}
+
+// free everything
+void ebr_destroy(ebr_t *e)
+{
+	ebr_retired_t *r, *next;
+
+	for (r = e->limbo; r; r = next) {
+		next = r->next;
+		r->release(r->ptr);
+		free(r);
+	}
+	e->limbo = NULL;
+	e->pending = 0;
+	free(e->slots);
+	e->slots = NULL;
+}
+
+// announce the current epoch
+void ebr_enter(ebr_t *e, int id)
+{
+	__atomic_store_n(&e->slots[id].state, __atomic_load_n(&e->epoch, __ATOMIC_RELAXED) << 1 | 1,
+			 __ATOMIC_RELAXED);
+	// store-load order: the announcement is visible before the shared pointers are read,
+	// paired with the fence of ebr_advance(); a writer advancing the epoch meanwhile finds
+	// us at the older epoch, which is safe
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// clear the announcement
+void ebr_exit(ebr_t *e, int id)
+{
+	__atomic_store_n(&e->slots[id].state, 0, __ATOMIC_RELEASE);
+}
+
+// the epoch advances when no reader is still in a section of an older one
+static inline
+bool ebr_advance(ebr_t *e)
+{
+	unsigned long epoch = e->epoch;
+	unsigned long state;
+	int i;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);	// the unlinking before the slots are read, paired with ebr_enter()
+	for (i = 0; i < e->readers; ++i) {
+		state = __atomic_load_n(&e->slots[i].state, __ATOMIC_ACQUIRE);
+		if ((state & 1) && state >> 1 != epoch)
+			return false;
+	}
+	__atomic_store_n(&e->epoch, epoch + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// advance and free
+void ebr_reclaim(ebr_t *e)
+{
+	ebr_retired_t **link, *r;
+
+	ebr_advance(e);
+	// the list is ordered by epochs: the first old enough starts the tail to free
+	for (link = &e->limbo; *link && (*link)->epoch + 2 > e->epoch; link = &(*link)->next)
+		;
+	while ((r = *link)) {
+		*link = r->next;
+		r->release(r->ptr);
+		free(r);
+		--e->pending;
+		++e->freed;
+	}
+	e->since = 0;
+}
+
+// put the node to the limbo list
+void ebr_retire(ebr_t *e, void *ptr, void (*release)(void *))
+{
+	ebr_retired_t *r;
+
+	if (!(r = malloc(sizeof(ebr_retired_t)))) {
+		// no memory for the record: wait for the grace period here
+		unsigned long epoch = e->epoch;
+
+		while (e->epoch < epoch + 2)
+			if (!ebr_advance(e))
+				sched_yield();
+		release(ptr);
+		++e->retired;
+		++e->freed;
+		return;
+	}
+	r->ptr = ptr;
+	r->release = release;
+	r->epoch = e->epoch;
+	r->next = e->limbo;
+	e->limbo = r;
+	++e->pending;
+	++e->retired;
+	if (++e->since >= EBR_RECLAIM_BATCH)
+		ebr_reclaim(e);
+}
+
+#endif // EPOCH_RECLAIM_H
@@ -0,0 +1,443 @@
+// Operating Systems: sample code
+// Threads
+// Fibers: user-space threads, N fibers on M OS threads
+//
+// A fiber is a function with its own small stack. Switching between fibers is done
+// in user space: the callee-saved registers are pushed to the old stack, the stack
+// pointer is swapped and the registers are popped from the new stack (x86-64 System V
+// ABI), no system call and no kernel scheduler are involved. M worker threads take the
+// ready fibers from a shared run queue and run each of them until it yields, blocks
+// or returns (cooperative scheduling, a fiber may continue on another worker).
+//
+// The fiber mutex and semaphore do not spin and do not put the OS thread to sleep:
+// a fiber which has to wait is queued at the lock and the worker switches to another
+// fiber; the unlock makes the first waiter ready again. The mutex is handed over to
+// the waiter directly (FIFO). The internal spinlock of the primitive is released only
+// by the worker after the fiber has been switched out, so no other worker can resume
+// the fiber while it is still running on its stack.
+//
+// usage:
+//
+// #include "fiber.h"
+//
+// fiber_sched_t sched;
+// fiber_mutex_t lock = FIBER_MUTEX_INITIALIZER;
+//
+// fiber_sched_init(&sched, workers);
+// fiber_spawn(&sched, fn, arg);	// fn(arg) runs as a fiber
+// fiber_sched_run(&sched);		// until all fibers have returned
+//
+// // in a fiber
+// fiber_mutex_lock(&lock);
+// // critical section
+// fiber_mutex_unlock(&lock);
+// fiber_yield();
+
+#ifndef FIBER_H
+#define FIBER_H
+
+#if !defined(__x86_64__)
+#	error "the fiber context switch is written for x86-64"
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>			// malloc(3)
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include <unistd.h>			// sysconf(3)
+#include <sys/mman.h>			// mmap(2), mprotect(2)
+#include <pthread.h>
+#include "test_and_set_bool.h"		// test_and_set(), release_lock(), cpu_relax()
+
+// the stack of a fiber, a guard page below it is not accessible
+#ifndef FIBER_STACK_SIZE
+#	define FIBER_STACK_SIZE	(1<<16)
+#endif
+
+// what the worker does after a fiber switched back to it
+typedef enum {
+	FIBER_YIELD,			// the fiber is ready again
+	FIBER_BLOCK,			// the fiber waits, release the spinlock of the primitive
+	FIBER_EXIT,			// the fiber returned, free it
+} fiber_action_t;
+
+// fiber data
+typedef struct fiber {
+	void *sp;			// the saved stack pointer
+	void *stack;			// the mapping: the guard page and the stack
+	size_t mapped;
+	void (*fn)(void *);
+	void *arg;
+	struct fiber *next;		// the run queue or a wait queue
+	struct fiber_sched *sched;
+} fiber_t;
+
+// a queue of fibers
+typedef struct {
+	fiber_t *head, *tail;
+} fiber_queue_t;
+
+// worker thread data
+typedef struct {
+	void *sp;			// the stack pointer of the scheduler loop
+	fiber_t *current;
+	fiber_action_t action;
+	volatile bool *action_lock;	// released after FIBER_BLOCK
+	struct fiber_sched *sched;
+	pthread_t tid;
+	long switches;			// switches to a fiber
+} __attribute__ ((aligned(64))) fiber_worker_t;
+
+// scheduler data
+typedef struct fiber_sched {
+	pthread_mutex_t lock;		// the run queue and live
+	pthread_cond_t ready;		// a fiber is ready or all fibers are done
+	fiber_queue_t run;
+	long live;			// fibers not returned yet
+	int n;
+	fiber_worker_t *workers;
+	long spawned;
+	size_t stack_bytes;		// mapped by the live fibers
+	size_t max_stack_bytes;
+} fiber_sched_t;
+
+// the fiber mutex
+typedef struct {
+	volatile bool spin;		// protects the rest
+	bool locked;
+	fiber_queue_t waiting;
+} fiber_mutex_t;
+
+#define FIBER_MUTEX_INITIALIZER	{ false, false, { NULL, NULL } }
+
+// the fiber semaphore
+typedef struct {
+	volatile bool spin;		// protects the rest
+	long value;
+	fiber_queue_t waiting;
+} fiber_sem_t;
+
+#define FIBER_SEM_INITIALIZER(value)	{ false, (value), { NULL, NULL } }
+
+// the worker of the current OS thread
+static __thread fiber_worker_t *fiber_tls_worker;
+
+// initialize the scheduler with the given number of workers, return 0 or an error number
+static inline
+int fiber_sched_init(fiber_sched_t *sched, int workers);
+
+// create a ready fiber running fn(arg), return 0 or an error number
+static inline
+int fiber_spawn(fiber_sched_t *sched, void (*fn)(void *), void *arg);
+
+// run the workers until all the fibers have returned, return 0 or an error number
+static inline
+int fiber_sched_run(fiber_sched_t *sched);
+
+// release the scheduler
+static inline
+void fiber_sched_destroy(fiber_sched_t *sched);
+
+// give up the worker to the other ready fibers
+static inline
+void fiber_yield(void);
+
+// lock the fiber mutex, wait as a fiber
+static inline
+void fiber_mutex_lock(fiber_mutex_t *m);
+
+// unlock the fiber mutex, hand it over to the first waiter
+static inline
+void fiber_mutex_unlock(fiber_mutex_t *m);
+
+// semaphore wait (P), wait as a fiber
+static inline
+void fiber_sem_wait(fiber_sem_t *s);
+
+// semaphore signal (V)
+static inline
+void fiber_sem_post(fiber_sem_t *s);
+
+
+// save the callee-saved registers and the stack pointer to *save, continue on the stack load
+__attribute__ ((naked, noinline)) static
+void fiber_switch(void **save, void *load)
+{
+	asm volatile (
+		"pushq %rbp\n\t"
+		"pushq %rbx\n\t"
+		"pushq %r12\n\t"
+		"pushq %r13\n\t"
+		"pushq %r14\n\t"
+		"pushq %r15\n\t"
+		"movq %rsp, (%rdi)\n\t"
+		"movq %rsi, %rsp\n\t"
+		"popq %r15\n\t"
+		"popq %r14\n\t"
+		"popq %r13\n\t"
+		"popq %r12\n\t"
+		"popq %rbx\n\t"
+		"popq %rbp\n\t"
+		"ret\n\t"
+	);
+}
+
+// the worker of the current OS thread; a fiber may move to another thread at any switch,
+// so the thread-local variable must be read again after each switch
+__attribute__ ((noinline, noipa)) static
+fiber_worker_t *fiber_worker(void)
+{
+	return fiber_tls_worker;
+}
+
+// append the fiber to the queue
+static inline
+void fiber_enqueue(fiber_queue_t *q, fiber_t *f)
+{
+	f->next = NULL;
+	if (q->tail)
+		q->tail->next = f;
+	else
+		q->head = f;
+	q->tail = f;
+}
+
+// remove the first fiber of the queue, NULL if empty
+static inline
+fiber_t *fiber_dequeue(fiber_queue_t *q)
+{
+	fiber_t *f = q->head;
+
+	if (f && !(q->head = f->next))
+		q->tail = NULL;
+	return f;
+}
+
+// make the fiber ready to run
+static inline
+void fiber_ready(fiber_t *f)
+{
+	fiber_sched_t *sched = f->sched;
+
+	pthread_mutex_lock(&sched->lock);
+	fiber_enqueue(&sched->run, f);
+	pthread_cond_signal(&sched->ready);
+	pthread_mutex_unlock(&sched->lock);
+}
+
+// switch from the current fiber back to the worker, which does the action
+static inline
+void fiber_leave(fiber_action_t action, volatile bool *lock)
+{
+	fiber_worker_t *w = fiber_worker();
+	fiber_t *f = w->current;
+
+	w->action = action;
+	w->action_lock = lock;
+	fiber_switch(&f->sp, w->sp);
+}
+
+// the first function on the stack of a fiber
+static
+void fiber_start(void)
+{
+	fiber_t *f = fiber_worker()->current;
+
+	f->fn(f->arg);
+	fiber_leave(FIBER_EXIT, NULL);	// never returns
+}
+
+// the scheduler loop of a worker: run the ready fibers until none is live
+static inline
+void *fiber_work(void *arg)
+{
+	fiber_worker_t *w = arg;
+	fiber_sched_t *sched = w->sched;
+	fiber_t *f;
+
+	fiber_tls_worker = w;
+	for (;;) {
+		pthread_mutex_lock(&sched->lock);
+		while (!(f = fiber_dequeue(&sched->run)) && sched->live)
+			pthread_cond_wait(&sched->ready, &sched->lock);
+		pthread_mutex_unlock(&sched->lock);
+		if (!f)
+			break;			// all fibers returned
+
+		w->current = f;
+		++w->switches;
+		fiber_switch(&w->sp, f->sp);	// back when the fiber yields, blocks or returns
+		w->current = NULL;
+
+		switch (w->action) {
+			case FIBER_YIELD:
+				fiber_ready(f);
+				break;
+			case FIBER_BLOCK:
+				release_lock(w->action_lock);	// now a waker may make it ready
+				break;
+			case FIBER_EXIT:
+				munmap(f->stack, f->mapped);
+				pthread_mutex_lock(&sched->lock);
+				sched->stack_bytes -= f->mapped;
+				if (!--sched->live)
+					pthread_cond_broadcast(&sched->ready);
+				pthread_mutex_unlock(&sched->lock);
+				free(f);
+				break;
+		}
+	}
+	return NULL;
+}
+
+// initialize the scheduler
+int fiber_sched_init(fiber_sched_t *sched, int workers)
+{
+	int rc;
+
+	memset(sched, 0, sizeof(*sched));
+	if (posix_memalign((void **) &sched->workers, 64, workers * sizeof(fiber_worker_t)))
+		return ENOMEM;
+	memset(sched->workers, 0, workers * sizeof(fiber_worker_t));
+	sched->n = workers;
+	if ((rc = pthread_mutex_init(&sched->lock, NULL)))
+		return rc;
+	return pthread_cond_init(&sched->ready, NULL);
+}
+
+// create a fiber
+int fiber_spawn(fiber_sched_t *sched, void (*fn)(void *), void *arg)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	fiber_t *f;
+	void **top;
+
+	if (!(f = malloc(sizeof(fiber_t))))
+		return ENOMEM;
+	f->mapped = page + FIBER_STACK_SIZE;
+	// the pages are allocated by the first touch: a fiber uses as much memory as it needs
+	f->stack = mmap(NULL, f->mapped, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (f->stack == MAP_FAILED || mprotect(f->stack, page, PROT_NONE)) {
+		free(f);
+		return errno;
+	}
+	f->fn = fn;
+	f->arg = arg;
+	f->sched = sched;
+
+	// the initial frame for fiber_switch(): 6 registers and the return address fiber_start,
+	// which is entered with the stack aligned as after a call (rsp + 8 is 16-byte aligned)
+	top = (void **) ((char *) f->stack + f->mapped);
+	*--top = NULL;			// the return address of fiber_start(), never used
+	*--top = (void *) fiber_start;
+	top -= 6;
+	memset(top, 0, 6 * sizeof(void *));
+	f->sp = top;
+
+	pthread_mutex_lock(&sched->lock);
+	++sched->live;
+	++sched->spawned;
+	if ((sched->stack_bytes += f->mapped) > sched->max_stack_bytes)
+		sched->max_stack_bytes = sched->stack_bytes;
+	fiber_enqueue(&sched->run, f);
+	pthread_cond_signal(&sched->ready);
+	pthread_mutex_unlock(&sched->lock);
+	return 0;
+}
+
+// run the workers
+int fiber_sched_run(fiber_sched_t *sched)
+{
+	int rc = 0;
+	int i, started;
+
+	for (started = 0; started < sched->n; ++started) {
+		sched->workers[started].sched = sched;
+		if ((rc = pthread_create(&sched->workers[started].tid, NULL, fiber_work, &sched->workers[started])))
+			break;
+	}
+	for (i = 0; i < started; ++i)
+		pthread_join(sched->workers[i].tid, NULL);
+	return rc;
+}
+
+// release the scheduler
+void fiber_sched_destroy(fiber_sched_t *sched)
+{
+	pthread_cond_destroy(&sched->ready);
+	pthread_mutex_destroy(&sched->lock);
+	free(sched->workers);
+	sched->workers = NULL;
+}
+
+// yield
+void fiber_yield(void)
+{
+	fiber_leave(FIBER_YIELD, NULL);
+}
+
+// take the spinlock of a primitive, held for a few instructions only
+static inline
+void fiber_spin_lock(volatile bool *spin)
+{
+	while (test_and_set(spin))
+		while (*spin)
+			cpu_relax();
+}
+
+// lock the fiber mutex
+void fiber_mutex_lock(fiber_mutex_t *m)
+{
+	fiber_spin_lock(&m->spin);
+	if (!m->locked) {
+		m->locked = true;
+		release_lock(&m->spin);
+		return;
+	}
+	fiber_enqueue(&m->waiting, fiber_worker()->current);
+	fiber_leave(FIBER_BLOCK, &m->spin);	// the worker releases the spinlock
+	// the mutex has been handed over to us, still locked
+}
+
+// unlock the fiber mutex
+void fiber_mutex_unlock(fiber_mutex_t *m)
+{
+	fiber_t *f;
+
+	fiber_spin_lock(&m->spin);
+	if (!(f = fiber_dequeue(&m->waiting)))
+		m->locked = false;
+	release_lock(&m->spin);
+	if (f)
+		fiber_ready(f);		// the new owner
+}
+
+// semaphore wait
+void fiber_sem_wait(fiber_sem_t *s)
+{
+	fiber_spin_lock(&s->spin);
+	if (s->value > 0) {
+		--s->value;
+		release_lock(&s->spin);
+		return;
+	}
+	fiber_enqueue(&s->waiting, fiber_worker()->current);
+	fiber_leave(FIBER_BLOCK, &s->spin);	// the worker releases the spinlock
+	// the post passed its unit to us
+}
+
+// semaphore signal
+void fiber_sem_post(fiber_sem_t *s)
+{
+	fiber_t *f;
+
+	fiber_spin_lock(&s->spin);
+	if (!(f = fiber_dequeue(&s->waiting)))
+		++s->value;
+	release_lock(&s->spin);
+	if (f)
+		fiber_ready(f);
+}
+
+#endif // FIBER_H
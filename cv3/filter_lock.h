@@ -0,0 +1,114 @@
+// Operating Systems: sample code
+// Critical Sections
+// SW method: filter lock, Peterson's algorithm for N threads
+//
+// There are n - 1 levels, a thread must pass all of them to enter the critical
+// section. At each level the last thread to arrive (the victim) waits while any
+// other thread is at the same or a higher level, so at most n - L threads get past
+// level L. With two threads it is exactly Peterson's algorithm.
+//
+// Unlike Peterson_sched.h, it is correct on SMP: the store of the own level and the
+// victim must be visible before the levels of the others are read. x86 may move
+// a load before an earlier store to a different address (store buffer), so all
+// shared accesses are sequentially consistent: the stores use xchg (a full barrier).
+// Waiting costs O(n) reads per level, O(n^2) in total: the price of using loads
+// and stores only.
+//
+// usage:
+//
+// #include "filter_lock.h"
+//
+// filter_init(n);		// threads 0 to n - 1, n <= FILTER_MAX_THREADS
+//
+// filter_wait(self);
+// // critical section
+// filter_post(self);
+
+#ifndef FILTER_LOCK_H
+#define FILTER_LOCK_H
+
+#include <stdbool.h>
+#include <sched.h>			// sched_yield(2)
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// the maximal number of threads
+#ifndef FILTER_MAX_THREADS
+#	define FILTER_MAX_THREADS	(1<<6)
+#endif
+
+// spins before the CPU is given up
+#ifndef FILTER_SPIN_LIMIT
+#	define FILTER_SPIN_LIMIT	(1<<7)
+#endif
+
+// one shared variable per cache line: the waiting threads read all of them
+typedef struct {
+	volatile int value;
+} __attribute__ ((aligned(64))) filter_slot_t;
+
+// filter data: the level of each thread and the victim of each level
+// static variables are always initialized to 0 (C standard)
+static filter_slot_t filter_level[FILTER_MAX_THREADS];
+static filter_slot_t filter_victim[FILTER_MAX_THREADS];
+static int filter_threads;
+
+// filter init
+__attribute__ ((always_inline)) static inline
+void filter_init(int n);
+
+// filter wait: enter the critical section
+__attribute__ ((always_inline)) static inline
+void filter_wait(int self);
+
+// filter signal: leave the critical section
+__attribute__ ((always_inline)) static inline
+void filter_post(int self);
+
+
+// filter init
+void filter_init(int n)
+{
+	int i;
+
+	filter_threads = n;
+	for (i = 0; i < FILTER_MAX_THREADS; ++i)
+		filter_level[i].value = 0;	// thread i: access to the critical section NOT needed
+}
+
+// true if any other thread is at the level or above
+static inline
+bool filter_conflict(int self, int level)
+{
+	int k;
+
+	for (k = 0; k < filter_threads; ++k)
+		if (k != self && __atomic_load_n(&filter_level[k].value, __ATOMIC_SEQ_CST) >= level)
+			return true;
+	return false;
+}
+
+// filter wait
+void filter_wait(int self)
+{
+	unsigned int spins = 0;
+	int level;
+
+	for (level = 1; level < filter_threads; ++level) {
+		__atomic_store_n(&filter_level[self].value, level, __ATOMIC_SEQ_CST);	// require the level
+		__atomic_store_n(&filter_victim[level].value, self, __ATOMIC_SEQ_CST);	// the others take precedence
+		while (__atomic_load_n(&filter_victim[level].value, __ATOMIC_SEQ_CST) == self
+		       && filter_conflict(self, level))
+			if (++spins % FILTER_SPIN_LIMIT)
+				cpu_relax();
+			else
+				sched_yield();	// the thread ahead of us may not be running
+	}
+}
+
+// filter signal
+void filter_post(int self)
+{
+	__atomic_store_n(&filter_level[self].value, 0, __ATOMIC_RELEASE);	// leave the critical section
+}
+
+#endif // FILTER_LOCK_H
@@ -0,0 +1,122 @@
+// Operating Systems: sample code
+// Critical Sections
+// Linux futex(2): spin-then-park mutex (Drepper, "Futexes Are Tricky", mutex3)
+//
+// The lock state: 0 = free, 1 = locked, 2 = locked and there may be sleeping waiters.
+// A thread finding the lock taken first spins for a while (the holder may release it
+// soon), then marks the lock as contended and sleeps in the kernel until woken up
+// by the holder. Unlike busy waiting with sched_yield(2) the sleeping thread consumes
+// no CPU time and is woken up exactly when the lock is released.
+//
+// The spin budget adapts to the critical section length: it follows a moving average
+// of the spins which were needed to get the lock (as the glibc adaptive mutex does).
+//
+// usage:
+//
+// #define _GNU_SOURCE		// syscall(2)
+// #include "futex_lock.h"
+//
+// futex_lock_t lock = FUTEX_LOCK_INITIALIZER;
+//
+// futex_lock(&lock);
+// // critical section
+// futex_unlock(&lock);
+
+#ifndef FUTEX_LOCK_H
+#define FUTEX_LOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>			// NULL
+#include <unistd.h>			// syscall(2)
+#include <sys/syscall.h>		// SYS_futex
+#include <linux/futex.h>		// FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// maximal spin budget (the number of lock state reads)
+#ifndef FUTEX_SPIN_MAX
+#	define FUTEX_SPIN_MAX	100
+#endif
+
+// futex lock data
+typedef struct {
+	volatile int state;		// 0: free, 1: locked, 2: locked, waiters possible
+	volatile int spins;		// moving average of the spins needed to get the lock
+} futex_lock_t;
+
+#define FUTEX_LOCK_INITIALIZER	{ 0, 0 }
+
+// acquire the lock
+__attribute__ ((always_inline)) static inline
+void futex_lock(futex_lock_t *lock);
+
+// release the lock
+__attribute__ ((always_inline)) static inline
+void futex_unlock(futex_lock_t *lock);
+
+
+// sleep while *addr == val
+static inline
+void futex_wait(volatile int *addr, int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+// wake up at most n threads sleeping on addr
+static inline
+void futex_wake(volatile int *addr, int n)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// atomically replace expected by desired, return the previous value (lock cmpxchg)
+static inline
+int futex_cmpxchg(volatile int *addr, int expected, int desired)
+{
+	__atomic_compare_exchange_n(addr, &expected, desired, false,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	return expected;
+}
+
+// acquire the lock
+void futex_lock(futex_lock_t *lock)
+{
+	int c;
+	int spins, limit;
+
+	// fast path: free -> locked
+	if ((c = futex_cmpxchg(&lock->state, 0, 1)) == 0)
+		return;
+
+	// spin: wait for the release while the holder is (probably) running
+	limit = 2 * lock->spins + 10;
+	if (limit > FUTEX_SPIN_MAX)
+		limit = FUTEX_SPIN_MAX;
+	for (spins = 0; spins < limit; ++spins) {
+		cpu_relax();
+		if (lock->state == 0 && (c = futex_cmpxchg(&lock->state, 0, 1)) == 0) {
+			lock->spins += (spins - lock->spins) / 8;
+			return;
+		}
+	}
+	lock->spins += (spins - lock->spins) / 8;
+
+	// park: mark the lock contended and sleep until it is free
+	if (c != 2)
+		c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+	while (c != 0) {
+		futex_wait(&lock->state, 2);
+		c = __atomic_exchange_n(&lock->state, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+// release the lock
+void futex_unlock(futex_lock_t *lock)
+{
+	// 1 -> 0: nobody waits; 2 -> 1: there may be sleepers, free the lock and wake one
+	if (__atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+		futex_wake(&lock->state, 1);
+	}
+}
+
+#endif // FUTEX_LOCK_H
@@ -0,0 +1,304 @@
+// Operating Systems: sample code
+// Threads
+// Group-commit journal: durable records without one sync per record
+//
+// The tellers append fixed-size records to a ring in memory without taking a lock:
+// a record gets its log sequence number (LSN) by fetch-and-add and is published by
+// storing LSN + 1 to its slot. One writer thread collects the published records in
+// the LSN order, writes the whole group by one write(2) and makes it durable by one
+// fdatasync(2); then it advances the durable LSN and wakes up the waiting tellers.
+// A record is acknowledged only after the durable LSN has passed it. The cost of
+// the sync (hundreds of microseconds on an SSD, milliseconds on a disk) is shared
+// by the group, and the records appended while the writer syncs form the next one.
+//
+// The writer starts a group as soon as a record is ready and then waits at most the
+// flush interval for more records, until the group has the maximum size. A longer
+// interval makes larger groups when the tellers are few, at the price of latency.
+//
+// The file is a sequence of journal_record_t in the LSN order.
+//
+// usage:
+//
+// #define _GNU_SOURCE		// syscall(2)
+// #include "journal.h"
+//
+// journal_t journal;
+//
+// journal_open(&journal, "journal.bin", capacity, group, interval_ns);	// starts the writer
+// lsn = journal_append(&journal, teller, amount);	// waits only for a full ring
+// journal_wait(&journal, lsn);			// until the record is durable
+// journal_close(&journal);			// flushes the rest, stops the writer
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stdlib.h>			// malloc(3)
+#include <stdio.h>			// perror(3)
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include <limits.h>			// INT_MAX
+#include <fcntl.h>			// open(2)
+#include <unistd.h>			// write(2), fdatasync(2), close(2)
+#include <time.h>			// clock_gettime(2)
+#include <sched.h>			// sched_yield(2)
+#include <pthread.h>
+#include "futex_lock.h"			// futex_wait(), futex_wake()
+
+// spins on the durable LSN before the teller sleeps
+#ifndef JOURNAL_SPIN_LIMIT
+#	define JOURNAL_SPIN_LIMIT	(1<<7)
+#endif
+
+// one journal record, 16 bytes
+typedef struct {
+	long lsn;
+	int teller;
+	int amount;
+} journal_record_t;
+
+// a slot of the ring
+typedef struct {
+	volatile long seq;		// lsn + 1 once the record is published
+	journal_record_t record;
+} journal_slot_t;
+
+// writer statistics, complete once the records are durable
+typedef struct {
+	long groups;			// write(2) + fdatasync(2) pairs
+	long records;
+	long max_group;			// records in the largest group
+	double sync_s;			// time spent in write(2) and fdatasync(2)
+} journal_stats_t;
+
+// journal data
+typedef struct {
+	// the appenders
+	volatile long next __attribute__ ((aligned(64)));	// the next LSN to hand out
+	volatile int writer_sleeping;	// futex: the writer waits for wake_at
+	volatile long wake_at;		// the LSN the writer waits for
+	// the writer
+	volatile long taken __attribute__ ((aligned(64)));	// LSNs below are copied out of the ring
+	volatile long durable;		// LSNs below are durable
+	volatile int epoch;		// futex: incremented after each group
+	volatile int waiters;		// tellers sleeping on the epoch
+	volatile bool stop;
+	journal_stats_t stats;
+	// constant after journal_open()
+	int fd;
+	long capacity;			// ring slots
+	int group;			// the maximum records per group
+	long interval_ns;		// the maximum wait for a larger group
+	journal_slot_t *ring;
+	journal_record_t *buffer;	// the group being written
+	pthread_t writer;
+} journal_t;
+
+// open (truncate) the file and start the writer, return 0 or an error number
+static inline
+int journal_open(journal_t *j, const char *path, long capacity, int group, long interval_ns);
+
+// append a record, return its LSN
+__attribute__ ((always_inline)) static inline
+long journal_append(journal_t *j, int teller, int amount);
+
+// wait until the record with the LSN is durable
+__attribute__ ((always_inline)) static inline
+void journal_wait(journal_t *j, long lsn);
+
+// make all the appended records durable, stop the writer and close the file
+static inline
+void journal_close(journal_t *j);
+
+
+// the end of the published records following first, at most max
+static inline
+long journal_ready(journal_t *j, long first, long max)
+{
+	while (first < max && __atomic_load_n(&j->ring[first % j->capacity].seq, __ATOMIC_ACQUIRE) == first + 1)
+		++first;
+	return first;
+}
+
+// sleep until the record lsn is published, the journal is stopped or the timeout (0: none) elapses
+static inline
+void journal_sleep(journal_t *j, long lsn, long timeout_ns)
+{
+	struct timespec timeout = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+
+	j->wake_at = lsn;
+	__atomic_store_n(&j->writer_sleeping, 1, __ATOMIC_SEQ_CST);
+	// an appender publishing now either sees us sleeping or is seen here
+	if (__atomic_load_n(&j->ring[lsn % j->capacity].seq, __ATOMIC_SEQ_CST) != lsn + 1
+	    && !__atomic_load_n(&j->stop, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &j->writer_sleeping, FUTEX_WAIT_PRIVATE, 1,
+			timeout_ns ? &timeout : NULL, NULL, 0);
+	__atomic_store_n(&j->writer_sleeping, 0, __ATOMIC_RELAXED);
+}
+
+// nanoseconds from start to now
+static inline
+long journal_ns_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+// write the group and sync it, exit on error
+static inline
+void journal_flush(journal_t *j, long first, long end)
+{
+	const char *p = (const char *) j->buffer;
+	size_t left = (end - first) * sizeof(journal_record_t);
+	struct timespec start;
+	ssize_t written;
+	long i;
+
+	// copy the group out, the slots can be reused
+	for (i = first; i < end; ++i)
+		j->buffer[i - first] = j->ring[i % j->capacity].record;
+	__atomic_store_n(&j->taken, end, __ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (; left; left -= written, p += written)
+		if ((written = write(j->fd, p, left)) < 0) {
+			perror("journal write");
+			exit(EXIT_FAILURE);
+		}
+	if (fdatasync(j->fd)) {
+		perror("journal fdatasync");
+		exit(EXIT_FAILURE);
+	}
+
+	// the statistics before the records are acknowledged
+	j->stats.sync_s += journal_ns_since(&start) / 1e9;
+	++j->stats.groups;
+	j->stats.records += end - first;
+	if (end - first > j->stats.max_group)
+		j->stats.max_group = end - first;
+
+	// acknowledge the group: the store must be visible before the waiters are checked
+	__atomic_store_n(&j->durable, end, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&j->epoch, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&j->waiters, __ATOMIC_SEQ_CST))
+		futex_wake(&j->epoch, INT_MAX);
+}
+
+// the writer thread: collect a group, write it, sync it, acknowledge it
+static inline
+void *journal_writer(void *arg)
+{
+	journal_t *j = arg;
+	long first = 0, end;		// the group: LSNs first to end - 1
+	long left;
+	struct timespec start;
+
+	for (;;) {
+		// the first record of the group
+		if ((end = journal_ready(j, first, first + j->group)) == first) {
+			if (__atomic_load_n(&j->stop, __ATOMIC_SEQ_CST)
+			    && __atomic_load_n(&j->next, __ATOMIC_SEQ_CST) == first)
+				break;		// everything is durable
+			journal_sleep(j, first, 0);
+			continue;
+		}
+		// more records for at most the flush interval
+		if (j->interval_ns && end - first < j->group) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			while ((end = journal_ready(j, first, first + j->group)) - first < j->group
+			       && (left = j->interval_ns - journal_ns_since(&start)) > 0
+			       && !__atomic_load_n(&j->stop, __ATOMIC_SEQ_CST))
+				journal_sleep(j, first + j->group - 1, left);
+		}
+		journal_flush(j, first, end);
+		first = end;
+	}
+	return NULL;
+}
+
+// open the journal and start the writer
+int journal_open(journal_t *j, const char *path, long capacity, int group, long interval_ns)
+{
+	int rc;
+
+	memset(j, 0, sizeof(*j));
+	j->capacity = capacity;
+	j->group = group;
+	j->interval_ns = interval_ns;
+	if (!(j->ring = calloc(capacity, sizeof(journal_slot_t)))
+	    || !(j->buffer = malloc(group * sizeof(journal_record_t)))) {
+		free(j->ring);
+		return ENOMEM;
+	}
+	if ((j->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		rc = errno;
+		free(j->ring);
+		free(j->buffer);
+		return rc;
+	}
+	if ((rc = pthread_create(&j->writer, NULL, journal_writer, j))) {
+		close(j->fd);
+		free(j->ring);
+		free(j->buffer);
+	}
+	return rc;
+}
+
+// append a record
+long journal_append(journal_t *j, int teller, int amount)
+{
+	long lsn = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED);
+	journal_slot_t *slot = &j->ring[lsn % j->capacity];
+
+	// the slot is free once the writer has copied out the record one ring earlier
+	while (lsn - __atomic_load_n(&j->taken, __ATOMIC_ACQUIRE) >= j->capacity)
+		sched_yield();
+	slot->record.lsn = lsn;
+	slot->record.teller = teller;
+	slot->record.amount = amount;
+	// publish, then check the sleeping writer: sequentially consistent against journal_sleep()
+	__atomic_store_n(&slot->seq, lsn + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&j->writer_sleeping, __ATOMIC_SEQ_CST) && lsn >= j->wake_at
+	    && __atomic_exchange_n(&j->writer_sleeping, 0, __ATOMIC_SEQ_CST))
+		futex_wake(&j->writer_sleeping, 1);
+	return lsn;
+}
+
+// wait until the record is durable
+void journal_wait(journal_t *j, long lsn)
+{
+	unsigned int spins = 0;
+	int epoch;
+
+	while (__atomic_load_n(&j->durable, __ATOMIC_ACQUIRE) <= lsn) {
+		if (++spins < JOURNAL_SPIN_LIMIT) {
+			cpu_relax();
+			continue;
+		}
+		// sleep until the next group is durable, the writer checks the waiters after the epoch
+		__atomic_fetch_add(&j->waiters, 1, __ATOMIC_SEQ_CST);
+		epoch = __atomic_load_n(&j->epoch, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&j->durable, __ATOMIC_SEQ_CST) <= lsn)
+			futex_wait(&j->epoch, epoch);
+		__atomic_fetch_sub(&j->waiters, 1, __ATOMIC_RELAXED);
+	}
+}
+
+// flush, stop and close
+void journal_close(journal_t *j)
+{
+	__atomic_store_n(&j->stop, true, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&j->writer_sleeping, 0, __ATOMIC_SEQ_CST))
+		futex_wake(&j->writer_sleeping, 1);
+	pthread_join(j->writer, NULL);
+	if (close(j->fd))
+		perror("journal close");
+	free(j->ring);
+	free(j->buffer);
+	j->ring = NULL;
+	j->buffer = NULL;
+}
+
+#endif // JOURNAL_H
@@ -0,0 +1,166 @@
+// Operating Systems: sample code
+// Threads
+// Latency histogram (HDR style) with TSC timestamps
+//
+// Values (TSC ticks) are counted in log-linear buckets: values below 2 * HIST_SUB are
+// exact, larger values fall into one of HIST_SUB equal sub-buckets of their power of two,
+// so the relative error is at most 1 / HIST_SUB (about 3 %). Recording is a few
+// instructions and touches one counter, each thread records into its own histogram
+// and the histograms are merged after the threads are joined.
+//
+// usage:
+//
+// #include "latency_hist.h"
+//
+// hist_t h;			// per-thread (about 10 kB)
+//
+// hist_init(&h);
+// t = tsc_read();
+// // measured code
+// hist_record(&h, tsc_read() - t);
+// ...
+// hist_merge(&total, &h);
+// hist_print("wait", &total, tsc_ns_per_tick());	// " wait_p50_ns=... wait_max_ns=..."
+
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>			// memset(3)
+#include <time.h>			// clock_gettime(2), nanosleep(2)
+
+#define HIST_SUB_BITS	5			// sub-buckets per power of two: 32
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	44			// larger values are counted as the maximum bucket
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// histogram data
+typedef struct {
+	uint64_t count;			// the number of recorded values
+	uint64_t min, max;		// exact extremes
+	uint64_t counts[HIST_BUCKETS];
+} hist_t;
+
+
+// read the time stamp counter
+static inline __attribute__ ((always_inline))
+uint64_t tsc_read(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+
+// the length of one TSC tick in ns, measured against CLOCK_MONOTONIC on the first call
+static inline
+double tsc_ns_per_tick(void)
+{
+	static double ns_per_tick = 0;
+	struct timespec start, end, pause = { 0, 20000000 };	// 20 ms
+	uint64_t t0, t1;
+
+	if (ns_per_tick == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		t0 = tsc_read();
+		nanosleep(&pause, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		t1 = tsc_read();
+		ns_per_tick = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (t1 - t0);
+	}
+	return ns_per_tick;
+}
+
+// clear the histogram
+static inline
+void hist_init(hist_t *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+// the bucket of the value
+static inline __attribute__ ((always_inline))
+unsigned int hist_index(uint64_t v)
+{
+	unsigned int shift;
+
+	if (v < 2 * HIST_SUB)
+		return v;				// exact
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;	// v >> shift is in [HIST_SUB, 2 * HIST_SUB)
+	if (shift >= HIST_MAX_BITS - HIST_SUB_BITS)		// v >= 2^HIST_MAX_BITS
+		return HIST_BUCKETS - 1;
+	return shift * HIST_SUB + (v >> shift);
+}
+
+// the highest value counted in the bucket
+static inline
+uint64_t hist_value(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < 2 * HIST_SUB)
+		return index;
+	shift = index / HIST_SUB - 1;
+	return ((uint64_t) (index - shift * HIST_SUB + 1) << shift) - 1;
+}
+
+// record one value
+static inline __attribute__ ((always_inline))
+void hist_record(hist_t *h, uint64_t v)
+{
+	++h->counts[hist_index(v)];
+	++h->count;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+// add the values of src to dst
+static inline
+void hist_merge(hist_t *dst, const hist_t *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; ++i)
+		dst->counts[i] += src->counts[i];
+	dst->count += src->count;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+// the value below which the given fraction (0 to 1) of the recorded values is
+static inline
+uint64_t hist_percentile(const hist_t *h, double fraction)
+{
+	uint64_t rank = (uint64_t) (fraction * h->count + 0.5);
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < HIST_BUCKETS; ++i)
+		if ((seen += h->counts[i]) >= rank)
+			// the last bucket has no upper bound
+			return hist_value(i) < h->max && i < HIST_BUCKETS - 1 ? hist_value(i) : h->max;
+	return h->max;
+}
+
+// print p50, p99, p99.9 and max in ns as key=value pairs with the given prefix
+static inline
+void hist_print(const char *prefix, const hist_t *h, double ns_per_tick)
+{
+	printf(" %s_p50_ns=%.0f %s_p99_ns=%.0f %s_p999_ns=%.0f %s_max_ns=%.0f",
+		prefix, hist_percentile(h, 0.5) * ns_per_tick,
+		prefix, hist_percentile(h, 0.99) * ns_per_tick,
+		prefix, hist_percentile(h, 0.999) * ns_per_tick,
+		prefix, h->max * ns_per_tick);
+}
+
+#endif // LATENCY_HIST_H
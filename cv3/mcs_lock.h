@@ -0,0 +1,101 @@
+// Operating Systems: sample code
+// Critical Sections
+// HW method: MCS queue lock (Mellor-Crummey, Scott)
+//
+// The waiting threads form a linked queue of nodes, each thread spins on the flag
+// in its own node (its own cache line), so the release of the lock touches only
+// the cache of the next thread in the queue. The lock is granted in FIFO order.
+// Each thread needs its own node for each lock it holds or waits for.
+// If the threads outnumber the CPUs, the predecessor may not be running:
+// after MCS_SPIN_LIMIT reads of the flag the waiting thread gives up the CPU.
+//
+// usage:
+//
+// #include "mcs_lock.h"
+//
+// mcs_lock_t lock = MCS_LOCK_INITIALIZER;
+// mcs_node_t node;		// per-thread, e.g. in thread-specific data
+//
+// mcs_lock(&lock, &node);
+// // critical section
+// mcs_unlock(&lock, &node);
+
+#ifndef MCS_LOCK_H
+#define MCS_LOCK_H
+
+#include <stddef.h>			// NULL
+#include <stdbool.h>
+#include <sched.h>			// sched_yield(2)
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// reads of the own flag before the CPU is given up
+#ifndef MCS_SPIN_LIMIT
+#	define MCS_SPIN_LIMIT	(1<<7)
+#endif
+
+// queue node, each on its own cache line
+typedef struct mcs_node {
+	struct mcs_node *volatile next;	// the next waiting thread
+	volatile bool locked;		// true while the thread has to wait
+} __attribute__ ((aligned(64))) mcs_node_t;
+
+// MCS lock data
+typedef struct {
+	mcs_node_t *volatile tail;	// the last thread in the queue, NULL: the lock is free
+} mcs_lock_t;
+
+#define MCS_LOCK_INITIALIZER	{ NULL }
+
+// acquire the lock
+__attribute__ ((always_inline)) static inline
+void mcs_lock(mcs_lock_t *lock, mcs_node_t *node);
+
+// release the lock
+__attribute__ ((always_inline)) static inline
+void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node);
+
+
+// acquire the lock
+void mcs_lock(mcs_lock_t *lock, mcs_node_t *node)
+{
+	mcs_node_t *pred;
+	unsigned int spins = 0;
+
+	node->next = NULL;
+	node->locked = true;
+
+	// append our node to the queue: atomic exchange of the tail (xchg)
+	pred = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+	if (pred == NULL)		// the queue was empty: the lock is ours
+		return;
+
+	// link behind the predecessor and spin on our own flag
+	__atomic_store_n(&pred->next, node, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE))
+		if (++spins % MCS_SPIN_LIMIT)
+			cpu_relax();
+		else
+			sched_yield();	// let the preempted predecessor run
+}
+
+// release the lock
+void mcs_unlock(mcs_lock_t *lock, mcs_node_t *node)
+{
+	mcs_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+	if (next == NULL) {
+		mcs_node_t *expected = node;
+
+		// no known successor: if we are still the tail, the queue becomes empty (cmpxchg)
+		if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return;
+		// a successor is just linking behind us: wait for it
+		while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL)
+			sched_yield();	// rare: the successor was preempted between xchg and link
+	}
+	// pass the lock to the successor
+	__atomic_store_n(&next->locked, false, __ATOMIC_RELEASE);
+}
+
+#endif // MCS_LOCK_H
@@ -0,0 +1,201 @@
+// Operating Systems: sample code
+// Threads
+// Bounded lock-free multi-producer multi-consumer queue (Vyukov)
+//
+// The queue is a ring of cells, each with a sequence number. The cell of the
+// position pos is free for the producer of pos when its sequence is pos, and holds
+// the item for the consumer of pos when it is pos + 1. A producer (consumer) claims
+// its position by compare-and-swap of the enqueue (dequeue) position, fills (empties)
+// the cell and publishes it by storing the next sequence: pos + 1 for the consumer,
+// pos + capacity for the producer one lap later. The producers and the consumers
+// touch different counters and meet only at the cells, no thread ever waits for
+// a lock holder; a full or empty queue is reported, not waited for.
+//
+// The blocking variants spin on a full (empty) queue and give up the CPU after
+// MPMC_SPIN_LIMIT attempts, the other side may not be running.
+//
+// usage:
+//
+// #include "mpmc_queue.h"
+//
+// mpmc_queue_t queue;
+//
+// mpmc_init(&queue, 1024);		// the capacity, a power of two
+// mpmc_push(&queue, item);		// waits while the queue is full
+// item = mpmc_pop(&queue);		// waits while the queue is empty
+// if (mpmc_try_pop(&queue, &item)) ...	// false: empty
+// mpmc_destroy(&queue);
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stdbool.h>
+#include <stdlib.h>			// posix_memalign(3)
+#include <errno.h>
+#include <sched.h>			// sched_yield(2)
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// attempts on a full or empty queue before the CPU is given up
+#ifndef MPMC_SPIN_LIMIT
+#	define MPMC_SPIN_LIMIT	(1<<6)
+#endif
+
+// one cell of the ring
+typedef struct {
+	volatile unsigned long seq;	// pos: free for the producer of pos, pos + 1: full for its consumer
+	void *item;
+} mpmc_cell_t;
+
+// queue data, the positions on their own cache lines
+typedef struct {
+	mpmc_cell_t *cells;
+	unsigned long mask;		// capacity - 1
+	volatile unsigned long enqueue __attribute__ ((aligned(64)));	// the next position to fill
+	volatile unsigned long dequeue __attribute__ ((aligned(64)));	// the next position to empty
+} __attribute__ ((aligned(64))) mpmc_queue_t;
+
+// initialize the empty queue, the capacity must be a power of two, return 0 or an error number
+static inline
+int mpmc_init(mpmc_queue_t *q, unsigned long capacity);
+
+// release the cells
+static inline
+void mpmc_destroy(mpmc_queue_t *q);
+
+// append the item, return false if the queue is full
+__attribute__ ((always_inline)) static inline
+bool mpmc_try_push(mpmc_queue_t *q, void *item);
+
+// remove the oldest item, return false if the queue is empty
+__attribute__ ((always_inline)) static inline
+bool mpmc_try_pop(mpmc_queue_t *q, void **item);
+
+// append the item, wait while the queue is full
+static inline
+void mpmc_push(mpmc_queue_t *q, void *item);
+
+// remove the oldest item, wait while the queue is empty
+static inline
+void *mpmc_pop(mpmc_queue_t *q);
+
+// the number of items, a snapshot which may be stale at once
+static inline
+unsigned long mpmc_size(mpmc_queue_t *q);
+
+
+// initialize the queue: the cell i is free for the position i
+int mpmc_init(mpmc_queue_t *q, unsigned long capacity)
+{
+	unsigned long i;
+
+	if (!capacity || capacity & (capacity - 1))
+		return EINVAL;
+	if (posix_memalign((void **) &q->cells, 64, capacity * sizeof(mpmc_cell_t)))
+		return ENOMEM;
+	for (i = 0; i < capacity; ++i) {
+		q->cells[i].seq = i;
+		q->cells[i].item = NULL;
+	}
+	q->mask = capacity - 1;
+	q->enqueue = 0;
+	q->dequeue = 0;
+	return 0;
+}
+
+// release the queue
+void mpmc_destroy(mpmc_queue_t *q)
+{
+	free(q->cells);
+	q->cells = NULL;
+}
+
+// append the item
+bool mpmc_try_push(mpmc_queue_t *q, void *item)
+{
+	unsigned long pos = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED);
+	mpmc_cell_t *cell;
+	long diff;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		diff = (long) (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (!diff) {
+			// the cell is free: claim the position (a failed CAS reloads pos)
+			if (__atomic_compare_exchange_n(&q->enqueue, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0)
+			return false;	// the consumer of the previous lap has not emptied it: full
+		else
+			pos = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED);	// another producer was faster
+	}
+	cell->item = item;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);	// publish to the consumer of pos
+	return true;
+}
+
+// remove the oldest item
+bool mpmc_try_pop(mpmc_queue_t *q, void **item)
+{
+	unsigned long pos = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED);
+	mpmc_cell_t *cell;
+	long diff;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		diff = (long) (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (!diff) {
+			// the cell is full: claim the position
+			if (__atomic_compare_exchange_n(&q->dequeue, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0)
+			return false;	// the producer of pos has not filled it: empty
+		else
+			pos = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED);	// another consumer was faster
+	}
+	*item = cell->item;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);	// free for the next lap
+	return true;
+}
+
+// append, spinning then yielding while full
+void mpmc_push(mpmc_queue_t *q, void *item)
+{
+	unsigned int spins = 0;
+
+	while (!mpmc_try_push(q, item))
+		if (++spins < MPMC_SPIN_LIMIT)
+			cpu_relax();
+		else {
+			spins = 0;
+			sched_yield();	// the consumers are probably preempted: let them run
+		}
+}
+
+// remove, spinning then yielding while empty
+void *mpmc_pop(mpmc_queue_t *q)
+{
+	unsigned int spins = 0;
+	void *item;
+
+	while (!mpmc_try_pop(q, &item))
+		if (++spins < MPMC_SPIN_LIMIT)
+			cpu_relax();
+		else {
+			spins = 0;
+			sched_yield();	// the producers are probably preempted: let them run
+		}
+	return item;
+}
+
+// the positions claimed by the producers minus those claimed by the consumers
+unsigned long mpmc_size(mpmc_queue_t *q)
+{
+	unsigned long dequeue = __atomic_load_n(&q->dequeue, __ATOMIC_RELAXED);
+	unsigned long enqueue = __atomic_load_n(&q->enqueue, __ATOMIC_RELAXED);
+
+	return (long) (enqueue - dequeue) > 0 ? enqueue - dequeue : 0;
+}
+
+#endif // MPMC_QUEUE_H
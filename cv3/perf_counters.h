@@ -0,0 +1,161 @@
+// Operating Systems: sample code
+// Threads
+// Per-thread performance counters: Linux perf_event_open(2)
+//
+// Each thread opens the counters for itself (pid 0, any CPU), enables them around
+// the measured code and reads them afterwards. The hardware events (cycles,
+// instructions, cache misses) are often unavailable in virtual machines and
+// containers; such events are skipped and only the software events (context
+// switches, CPU migrations, task clock) which the kernel always provides are used.
+// If the kernel allows only user-space measurement (perf_event_paranoid), the
+// events are opened with the kernel excluded.
+//
+// usage:
+//
+// #define _GNU_SOURCE		// syscall(2)
+// #include "perf_counters.h"
+//
+// perf_counters_t pc;
+//
+// perf_open(&pc);		// in the measured thread
+// perf_start(&pc);
+// // measured code
+// perf_stop(&pc);
+// for (e = 0; e < PERF_EVENTS; ++e)
+//	if (perf_valid(&pc, e))
+//		printf("%s=%llu\n", perf_events[e].name, pc.value[e]);
+// perf_close(&pc);
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include <unistd.h>			// syscall(2), read(2), close(2)
+#include <sys/ioctl.h>			// ioctl(2)
+#include <sys/syscall.h>		// SYS_perf_event_open
+#include <linux/perf_event.h>
+
+// measured events
+typedef enum {
+	PERF_CYCLES,			// CPU cycles
+	PERF_INSTRUCTIONS,		// retired instructions
+	PERF_LLC_MISSES,		// last level cache misses
+	PERF_L1D_MISSES,		// L1 data cache read misses: proxy of cache line transfers
+	PERF_CONTEXT_SWITCHES,		// context switches (software)
+	PERF_CPU_MIGRATIONS,		// moves to another CPU (software)
+	PERF_TASK_CLOCK,		// CPU time in ns (software)
+	PERF_EVENTS			// the number of events
+} perf_event_t;
+
+static const struct {
+	const char *name;		// name in the reports
+	uint32_t type;			// perf_event_attr.type
+	uint64_t config;		// perf_event_attr.config
+} perf_events[PERF_EVENTS] = {
+	[PERF_CYCLES]		= { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS]	= { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_LLC_MISSES]	= { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_L1D_MISSES]	= { "l1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	[PERF_CONTEXT_SWITCHES]	= { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	[PERF_CPU_MIGRATIONS]	= { "cpu_migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+	[PERF_TASK_CLOCK]	= { "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+// counters of one thread
+typedef struct {
+	int fd[PERF_EVENTS];		// -1: the event is not available or the counter is closed
+	bool valid[PERF_EVENTS];	// the event is measured (remains set after perf_close())
+	uint64_t value[PERF_EVENTS];	// values read by perf_stop(), scaled if multiplexed
+} perf_counters_t;
+
+// open the counters for the calling thread, return the number of available events
+static inline
+int perf_open(perf_counters_t *pc)
+{
+	struct perf_event_attr attr;
+	int e, opened = 0;
+
+	for (e = 0; e < PERF_EVENTS; ++e) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[e].type;
+		attr.config = perf_events[e].config;
+		attr.disabled = 1;		// enabled by perf_start()
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		pc->fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (pc->fd[e] < 0 && (errno == EACCES || errno == EPERM)) {
+			attr.exclude_kernel = 1;	// user space only
+			pc->fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+		pc->value[e] = 0;
+		pc->valid[e] = pc->fd[e] >= 0;
+		if (pc->valid[e])
+			++opened;
+	}
+	return opened;
+}
+
+// reset and enable the counters
+static inline
+void perf_start(perf_counters_t *pc)
+{
+	int e;
+
+	for (e = 0; e < PERF_EVENTS; ++e)
+		if (pc->fd[e] >= 0) {
+			ioctl(pc->fd[e], PERF_EVENT_IOC_RESET, 0);
+			ioctl(pc->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+		}
+}
+
+// disable the counters and read their values
+static inline
+void perf_stop(perf_counters_t *pc)
+{
+	uint64_t data[3];		// value, time enabled, time running
+	int e;
+
+	for (e = 0; e < PERF_EVENTS; ++e)
+		if (pc->fd[e] >= 0)
+			ioctl(pc->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+	for (e = 0; e < PERF_EVENTS; ++e) {
+		if (pc->fd[e] < 0)
+			continue;
+		if (read(pc->fd[e], data, sizeof(data)) != sizeof(data)) {
+			pc->value[e] = 0;
+			continue;
+		}
+		// the event shared the PMU with others (multiplexing): extrapolate
+		if (data[2] && data[2] < data[1])
+			data[0] = (uint64_t) ((double) data[0] * data[1] / data[2]);
+		pc->value[e] = data[0];
+	}
+}
+
+// true if the event is measured
+static inline
+bool perf_valid(const perf_counters_t *pc, perf_event_t e)
+{
+	return pc->valid[e];
+}
+
+// release the counters
+static inline
+void perf_close(perf_counters_t *pc)
+{
+	int e;
+
+	for (e = 0; e < PERF_EVENTS; ++e)
+		if (pc->fd[e] >= 0) {
+			close(pc->fd[e]);
+			pc->fd[e] = -1;
+		}
+}
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,234 @@
+// Operating Systems: sample code
+// Threads
+// Task spawn and steal cost: thread pool against a thread per task
+//
+// The same number of tasks (each a short busy loop) is run in one of the modes:
+//   pthread  pthread_create(3) and pthread_join(3) for each task, workers at a time
+//   submit   the main thread submits all tasks to the pool (the injection queue)
+//   spawn    fork-join: a task splits its range and spawns the upper half to its own
+//            deque, the other workers steal it
+// The time per task is the overhead of starting a unit of work (plus the loop).
+//
+// usage: pool_bench [-m mode] [-t workers] [-n tasks] [-w work] [-q]
+//
+// Results are printed as "key=value" records:
+//   worker ...   tasks run and stolen by each worker (pool modes)
+//   result mode=... workers=... tasks=... elapsed_s=... ns_per_task=... steals=...
+
+#define _GNU_SOURCE               // syscall(2), posix_memalign(3)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "thread_pool.h"          // work-stealing thread pool
+#include "bench_opts.h"          // option parsing, elapsed time
+
+#define WORKERS 4                  // default number of workers
+#define TASKS (1<<16)              // default number of tasks
+#define WORK 100                   // default busy loop iterations per task
+
+// benchmark modes
+typedef enum {
+    MODE_PTHREAD,            // a thread per task
+    MODE_SUBMIT,            // all tasks submitted from the main thread
+    MODE_SPAWN,             // tasks spawned by tasks, stolen by the workers
+    MODES                   // the number of modes
+} bench_mode_t;
+
+static const char *mode_names[MODES] = {
+    [MODE_PTHREAD] = "pthread",
+    [MODE_SUBMIT]  = "submit",
+    [MODE_SPAWN]   = "spawn",
+};
+
+bench_mode_t mode = MODE_SPAWN;
+int workers = WORKERS;
+long tasks = TASKS;
+long work = WORK;
+int verbose = 1;
+
+pool_t pool;
+pool_wait_t all = POOL_WAIT_INITIALIZER;    // all tasks of the run
+
+// the range of the tasks of a spawn task, ranges[lo] belongs to the task lo
+typedef struct {
+    long lo, hi;
+} range_t;
+
+range_t *ranges = NULL;
+
+// the work of one task
+static void busy(void) {
+    volatile long i;
+
+    for (i = 0; i < work; ++i)
+        ;
+}
+
+// a task: the work only
+void do_task(void *arg) {
+    busy();
+}
+
+// a thread: the work only
+void *do_thread(void *arg) {
+    busy();
+    return NULL;
+}
+
+// a spawn task: spawn the upper halves of the range, then do the work of its first task
+void do_range(void *arg) {
+    range_t *r = arg;
+    long mid;
+
+    while (r->hi - r->lo > 1) {
+        mid = r->lo + (r->hi - r->lo) / 2;
+        ranges[mid].lo = mid;
+        ranges[mid].hi = r->hi;
+        pool_submit(&pool, &all, do_range, &ranges[mid]);
+        r->hi = mid;
+    }
+    busy();
+}
+
+// print usage and exit
+static void usage(const char *prog, int status) {
+    fprintf(status ? stderr : stdout,
+            "usage: %s [-m mode] [-t workers] [-n tasks] [-w work] [-q]\n"
+            "  -m mode          pthread, submit, spawn (default: spawn)\n"
+            "  -t workers       pool workers, threads at a time in the pthread mode (default: %d)\n"
+            "  -n tasks         the number of tasks (default: %d)\n"
+            "  -w work          busy loop iterations per task (default: %d)\n"
+            "  -q               print the result record only\n",
+            prog, WORKERS, TASKS, WORK);
+    exit(status);
+}
+
+// find the mode by its name, exit on error
+static bench_mode_t parse_mode(const char *prog, const char *name) {
+    int m;
+
+    for (m = 0; m < MODES; ++m)
+        if (!strcmp(name, mode_names[m]))
+            return m;
+    fprintf(stderr, "%s: unknown mode: %s\n", prog, name);
+    usage(prog, EXIT_FAILURE);
+    return MODES;    // not reached
+}
+
+// a thread per task, at most workers threads at a time
+static void run_threads(void) {
+    pthread_t *tids;
+    long i, j, n;
+
+    if (!(tids = malloc(workers * sizeof(pthread_t)))) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < tasks; i += n) {
+        n = tasks - i < workers ? tasks - i : workers;
+        for (j = 0; j < n; ++j)
+            if ((errno = pthread_create(&tids[j], NULL, do_thread, NULL))) {
+                perror("pthread_create");
+                exit(EXIT_FAILURE);
+            }
+        for (j = 0; j < n; ++j)
+            pthread_join(tids[j], NULL);
+    }
+    free(tids);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    long i;
+    long executed = 0, steals = 0, spawned = 0;
+    struct timespec start, end;
+    double elapsed;
+
+    // options
+    while ((opt = getopt(argc, argv, "m:t:n:w:qh")) != -1) {
+        switch (opt) {
+            case 'm':
+                mode = parse_mode(argv[0], optarg);
+                break;
+            case 't':
+                workers = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'n':
+                tasks = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'w':
+                work = parse_positive(argv[0], opt, optarg);
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(argv[0], EXIT_SUCCESS);
+            default:
+                usage(argv[0], EXIT_FAILURE);
+        }
+    }
+
+    if (verbose)
+        printf("config mode=%s workers=%d tasks=%ld work=%ld cpus=%ld\n",
+               mode_names[mode], workers, tasks, work, sysconf(_SC_NPROCESSORS_ONLN));
+
+    // the workers are started before the measurement
+    if (mode != MODE_PTHREAD) {
+        if (mode == MODE_SPAWN && !(ranges = malloc(tasks * sizeof(range_t)))) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        if ((errno = pool_init(&pool, workers))) {
+            perror("pool_init");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    switch (mode) {
+        case MODE_PTHREAD:
+            run_threads();
+            break;
+        case MODE_SUBMIT:
+            for (i = 0; i < tasks; ++i)
+                pool_submit(&pool, &all, do_task, NULL);
+            pool_wait(&pool, &all);
+            break;
+        default:
+            // the root task covers all the tasks
+            ranges[0].lo = 0;
+            ranges[0].hi = tasks;
+            pool_submit(&pool, &all, do_range, &ranges[0]);
+            pool_wait(&pool, &all);
+            break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // the statistics of the workers, before they are released
+    if (mode != MODE_PTHREAD) {
+        for (i = 0; i < workers; ++i) {
+            executed += pool.workers[i].executed;
+            steals += pool.workers[i].steals;
+            spawned += pool.workers[i].spawned;
+            if (verbose)
+                printf("worker id=%ld executed=%ld steals=%ld spawned=%ld\n", i, pool.workers[i].executed,
+                       pool.workers[i].steals, pool.workers[i].spawned);
+        }
+        pool_destroy(&pool);
+        if (executed != tasks)
+            fprintf(stderr, "TASKS LOST: %ld executed, %ld submitted\n", executed, tasks);
+    }
+    elapsed = elapsed_seconds(&start, &end);
+    printf("result mode=%s workers=%d tasks=%ld elapsed_s=%.6f ns_per_task=%.1f steals=%ld spawned=%ld\n",
+           mode_names[mode], workers, tasks, elapsed, elapsed * 1e9 / tasks, steals, spawned);
+
+    free(ranges);
+    return EXIT_SUCCESS;
+}
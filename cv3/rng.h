@@ -0,0 +1,61 @@
+// Operating Systems: sample code
+// Threads
+// Per-thread pseudo-random number generator: xorshift64* (Marsaglia, Vigna)
+//
+// rand(3) keeps one shared state guarded by a lock, so threads calling it serialize.
+// Each thread owns its rng_t here; the state is seeded by splitmix64 from a common
+// seed and the thread (stream) number, so a run is reproducible from a single seed.
+//
+// usage:
+//
+// #include "rng.h"
+//
+// rng_t rng;
+//
+// rng_seed(&rng, seed, thread_id);
+// amount = 1 + rng_below(&rng, MAX_WITHDRAW);	// 1 to MAX_WITHDRAW
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// generator state, must never be zero
+typedef struct {
+	uint64_t state;
+} rng_t;
+
+// seed the generator of the given stream (e.g. thread number)
+static inline
+void rng_seed(rng_t *rng, uint64_t seed, uint64_t stream)
+{
+	// splitmix64: spreads similar seeds over the whole state space
+	uint64_t z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	rng->state = z ? z : 1;
+}
+
+// the next 64-bit pseudo-random number
+static inline
+uint64_t rng_next(rng_t *rng)
+{
+	uint64_t x = rng->state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	rng->state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+// pseudo-random number from 0 to n - 1 (multiply-shift, no division)
+static inline
+uint32_t rng_below(rng_t *rng, uint32_t n)
+{
+	return (uint32_t) (((rng_next(rng) >> 32) * n) >> 32);
+}
+
+#endif // RNG_H
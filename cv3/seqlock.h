@@ -0,0 +1,103 @@
+// Operating Systems: sample code
+// Critical Sections
+// Sequence lock: readers never write to shared memory
+//
+// The writer (serialized by another lock) makes the sequence number odd before it
+// changes the data and even again after. A reader notes an even sequence number,
+// reads the data and retries if the number has changed meanwhile. The readers
+// do not write anything shared, so any number of them scales without bouncing
+// a cache line; the price is a retry when a writer interferes.
+// The protected data must be read with plain (volatile) loads only and the values
+// must not be used before seqlock_read_retry() returns false.
+//
+// usage:
+//
+// #include "seqlock.h"
+//
+// seqlock_t seq = SEQLOCK_INITIALIZER;
+//
+// // writer, holds the writers' lock
+// seqlock_write_begin(&seq);
+// balance -= amount;
+// seqlock_write_end(&seq);
+//
+// // reader
+// do {
+//	start = seqlock_read_begin(&seq);
+//	copy = balance;
+// } while (seqlock_read_retry(&seq, start));
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdbool.h>
+#include <sched.h>			// sched_yield(2)
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// sequence lock data
+typedef struct {
+	volatile unsigned int seq;	// odd: a write is in progress
+} seqlock_t;
+
+#define SEQLOCK_INITIALIZER	{ 0 }
+
+// spins on an odd sequence before the CPU is given up (the writer may be preempted)
+#ifndef SEQLOCK_SPIN_LIMIT
+#	define SEQLOCK_SPIN_LIMIT	(1<<7)
+#endif
+
+// start writing, the writers must be serialized
+__attribute__ ((always_inline)) static inline
+void seqlock_write_begin(seqlock_t *lock);
+
+// finish writing
+__attribute__ ((always_inline)) static inline
+void seqlock_write_end(seqlock_t *lock);
+
+// wait for no writer and return the sequence number
+__attribute__ ((always_inline)) static inline
+unsigned int seqlock_read_begin(const seqlock_t *lock);
+
+// true if the data read since seqlock_read_begin() may be inconsistent
+__attribute__ ((always_inline)) static inline
+bool seqlock_read_retry(const seqlock_t *lock, unsigned int start);
+
+
+// start writing
+void seqlock_write_begin(seqlock_t *lock)
+{
+	__atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);
+	// the odd sequence must be visible before any data store
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// finish writing
+void seqlock_write_end(seqlock_t *lock)
+{
+	// the data stores must be visible before the even sequence
+	__atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELEASE);
+}
+
+// wait for no writer and return the sequence number
+unsigned int seqlock_read_begin(const seqlock_t *lock)
+{
+	unsigned int seq;
+	unsigned int spins = 0;
+
+	while ((seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE)) & 1)
+		if (++spins % SEQLOCK_SPIN_LIMIT)
+			cpu_relax();
+		else
+			sched_yield();
+	return seq;
+}
+
+// true if the data read since seqlock_read_begin() may be inconsistent
+bool seqlock_read_retry(const seqlock_t *lock, unsigned int start)
+{
+	// the data loads must complete before the sequence is checked again
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != start;
+}
+
+#endif // SEQLOCK_H
@@ -0,0 +1,189 @@
+// Operating Systems: sample code
+// Threads
+// Synchronization: reusable barriers
+//
+// pthread_barrier_t: the waiting threads sleep on one futex and are all woken up
+// by the last one, every crossing goes through the kernel.
+// Sense-reversing barrier: a shared counter and a shared sense flag; the last
+// thread to arrive resets the counter and flips the sense, the others spin on the
+// flag. Each crossing uses the opposite sense, so the barrier is reusable at once.
+// Tournament barrier: the threads meet in pairs in log2(n) rounds, the loser of
+// each pair signals the winner and waits; the champion (thread 0) then wakes up
+// the losers down the same tree. Every thread spins on its own cache line and no
+// counter is shared by all threads.
+//
+// The spinning barriers give up the CPU after BARRIER_SPIN_LIMIT spins, so they
+// work even if the threads outnumber the CPUs.
+//
+// usage:
+//
+// #define _GNU_SOURCE		// pthread barriers, posix_memalign(3)
+// #include "spin_barrier.h"
+//
+// barrier_t barrier;
+//
+// barrier_init(&barrier, BARRIER_TREE, n);	// n participants with ids 0 to n - 1
+// ret = barrier_wait(&barrier, id);		// BARRIER_SERIAL_THREAD for exactly one
+// barrier_destroy(&barrier);
+
+#ifndef SPIN_BARRIER_H
+#define SPIN_BARRIER_H
+
+#include <stdlib.h>			// posix_memalign(3), free(3)
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include <sched.h>			// sched_yield(2)
+#include <pthread.h>
+#include "test_and_set_bool.h"		// cpu_relax()
+
+#define BARRIER_SERIAL_THREAD	PTHREAD_BARRIER_SERIAL_THREAD
+
+// the maximal number of tournament rounds: at most 2^BARRIER_ROUNDS participants
+#define BARRIER_ROUNDS	14
+
+// spins before the CPU is given up
+#ifndef BARRIER_SPIN_LIMIT
+#	define BARRIER_SPIN_LIMIT	(1<<8)
+#endif
+
+// barrier implementations
+typedef enum {
+	BARRIER_PTHREAD,		// pthread_barrier_t
+	BARRIER_SR,			// sense-reversing, centralized counter
+	BARRIER_TREE,			// tournament
+	BARRIER_TYPES			// the number of types
+} barrier_type_t;
+
+static const char *barrier_names[BARRIER_TYPES] __attribute__ ((unused)) = {
+	[BARRIER_PTHREAD]	= "pthread",
+	[BARRIER_SR]		= "sr",
+	[BARRIER_TREE]		= "tree",
+};
+
+// per-participant data, each on its own cache line
+typedef struct {
+	volatile int arrive[BARRIER_ROUNDS];	// tournament: the loser of the round has arrived
+	volatile int wakeup;			// tournament: released by the winner
+	int sense;				// the sense of the current crossing, private
+} __attribute__ ((aligned(64))) barrier_node_t;
+
+// barrier data
+typedef struct {
+	barrier_type_t type;
+	int n;					// the number of participants
+	pthread_barrier_t pthread;		// BARRIER_PTHREAD
+	volatile int count __attribute__ ((aligned(64)));	// BARRIER_SR: yet to arrive
+	volatile int sense;			// BARRIER_SR: flipped by the last one to arrive
+	barrier_node_t *nodes;			// BARRIER_SR, BARRIER_TREE
+} barrier_t;
+
+
+// spin until *flag == value
+static inline
+void barrier_spin(volatile int *flag, int value)
+{
+	unsigned int spins = 0;
+
+	while (__atomic_load_n(flag, __ATOMIC_ACQUIRE) != value)
+		if (++spins % BARRIER_SPIN_LIMIT)
+			cpu_relax();
+		else
+			sched_yield();	// the thread we wait for may not be running
+}
+
+// initialize the barrier for n participants, return 0 or an error number
+static inline
+int barrier_init(barrier_t *b, barrier_type_t type, int n)
+{
+	memset(b, 0, sizeof(*b));
+	b->type = type;
+	b->n = n;
+	switch (type) {
+	case BARRIER_PTHREAD:
+		return pthread_barrier_init(&b->pthread, NULL, n);
+	case BARRIER_TREE:
+		if (n > 1 << BARRIER_ROUNDS)
+			return EINVAL;
+		// fall through
+	case BARRIER_SR:
+		if (n <= 0)
+			return EINVAL;
+		if (posix_memalign((void **) &b->nodes, sizeof(barrier_node_t), n * sizeof(barrier_node_t)))
+			return ENOMEM;
+		memset(b->nodes, 0, n * sizeof(barrier_node_t));
+		b->count = n;
+		return 0;
+	default:
+		return EINVAL;
+	}
+}
+
+// sense-reversing barrier crossing
+static inline
+int sr_barrier_wait(barrier_t *b, int id)
+{
+	int sense = b->nodes[id].sense = !b->nodes[id].sense;
+
+	if (__atomic_sub_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == 0) {
+		// the last one: nobody touches the counter until the sense is flipped
+		b->count = b->n;
+		__atomic_store_n(&b->sense, sense, __ATOMIC_RELEASE);
+		return BARRIER_SERIAL_THREAD;
+	}
+	barrier_spin(&b->sense, sense);
+	return 0;
+}
+
+// tournament barrier crossing
+static inline
+int tree_barrier_wait(barrier_t *b, int id)
+{
+	barrier_node_t *self = &b->nodes[id];
+	int sense = self->sense = !self->sense;
+	int k, j;
+
+	// arrival: in round k the thread with bit k set loses to the one with bit k clear
+	for (k = 0; (1 << k) < b->n; ++k) {
+		if (id & (1 << k)) {
+			__atomic_store_n(&b->nodes[id - (1 << k)].arrive[k], sense, __ATOMIC_RELEASE);
+			barrier_spin(&self->wakeup, sense);
+			break;
+		}
+		if (id + (1 << k) < b->n)
+			barrier_spin(&self->arrive[k], sense);
+	}
+	// wakeup: release the threads beaten in the previous rounds
+	for (j = k - 1; j >= 0; --j)
+		if (id + (1 << j) < b->n)
+			__atomic_store_n(&b->nodes[id + (1 << j)].wakeup, sense, __ATOMIC_RELEASE);
+
+	return id == 0 ? BARRIER_SERIAL_THREAD : 0;
+}
+
+// wait until all n participants arrive, id is the participant number (0 to n - 1);
+// return BARRIER_SERIAL_THREAD for exactly one participant, 0 for the others or an error number
+static inline
+int barrier_wait(barrier_t *b, int id)
+{
+	switch (b->type) {
+	case BARRIER_SR:
+		return sr_barrier_wait(b, id);
+	case BARRIER_TREE:
+		return tree_barrier_wait(b, id);
+	default:
+		return pthread_barrier_wait(&b->pthread);
+	}
+}
+
+// release the barrier resources, return 0 or an error number
+static inline
+int barrier_destroy(barrier_t *b)
+{
+	free(b->nodes);
+	b->nodes = NULL;
+	if (b->type == BARRIER_PTHREAD)
+		return pthread_barrier_destroy(&b->pthread);
+	return 0;
+}
+
+#endif // SPIN_BARRIER_H
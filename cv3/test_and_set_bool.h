@@ -4,6 +4,14 @@
 //
 // Modified: 2015-11-25, 2017-12-06, 2020-11-23, 2021-11-09 (Intel syntax)
 //
+// Two backends:
+//   xchg  x86 inline asm, xchg with the implicit lock prefix: a full barrier
+//   C11   atomic_exchange with acquire order, atomic_store with release order;
+//         portable, the compiler knows the ordering and may move code around the lock
+//         in the allowed direction only
+// Releasing the lock needs a barrier too: a plain store to a volatile variable does
+// not stop the compiler from moving other memory accesses after it.
+//
 // usage:
 //
 // #include <stdbool.h>
@@ -12,11 +20,42 @@
 // volatile bool locked = false;
 //
 // ret = test_and_set(&locked);
+// release_lock(&locked);
+//
+// atomic_bool c11_locked = false;
+//
+// ret = test_and_set_c11(&c11_locked);
+// release_lock_c11(&c11_locked);
+//
+// while (locked)
+//	cpu_relax();		// spin-wait loop hint
+
+#ifndef TEST_AND_SET_BOOL_H
+#define TEST_AND_SET_BOOL_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
 
 // atomic store of true into *locked and return previous value of *locked
 __attribute__ ((always_inline)) static inline
 int test_and_set(volatile bool *locked);
 
+// store false into *locked, memory accesses before it stay before it
+__attribute__ ((always_inline)) static inline
+void release_lock(volatile bool *locked);
+
+// atomic store of true into *locked and return previous value of *locked, acquire order
+__attribute__ ((always_inline)) static inline
+bool test_and_set_c11(atomic_bool *locked);
+
+// store false into *locked, release order
+__attribute__ ((always_inline)) static inline
+void release_lock_c11(atomic_bool *locked);
+
+// spin-wait loop hint: the pause instruction (saves power, avoids memory order violation on loop exit)
+__attribute__ ((always_inline)) static inline
+void cpu_relax(void);
+
 
 // atomic store of true into *locked and return previous value of *locked
 int test_and_set(volatile bool *locked)
@@ -33,3 +72,33 @@ int test_and_set(volatile bool *locked)
 
 	return ret;
 }
+
+// release the lock taken by test_and_set()
+void release_lock(volatile bool *locked)
+{
+	// compiler barrier; x86 does not reorder a store with earlier loads and stores
+	asm volatile ("" ::: "memory");
+	*locked = false;
+}
+
+// atomic store of true into *locked and return previous value of *locked
+bool test_and_set_c11(atomic_bool *locked)
+{
+	// acquire: the critical section cannot move before the lock is taken
+	return atomic_exchange_explicit(locked, true, memory_order_acquire);
+}
+
+// release the lock taken by test_and_set_c11()
+void release_lock_c11(atomic_bool *locked)
+{
+	// release: the critical section cannot move after the lock is freed
+	atomic_store_explicit(locked, false, memory_order_release);
+}
+
+// spin-wait loop hint
+void cpu_relax(void)
+{
+	asm volatile ("pause" ::: "memory");
+}
+
+#endif // TEST_AND_SET_BOOL_H
@@ -0,0 +1,75 @@
+// Operating Systems: sample code
+// Threads
+// Latency histogram self-test
+//
+// Records values over the whole 64-bit range into the histogram of latency_hist.h
+// and checks that every value falls into a bucket inside the array, that the bucket
+// covers the value with the promised relative error and that the percentiles stay
+// within the recorded extremes. Values of HIST_MAX_BITS bits and more must land in the
+// last bucket.
+//
+// usage: test_latency_hist
+//
+// The result is printed as a "key=value" record, the exit status is 0 if all passed:
+//   result checked=... failed=...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "latency_hist.h"          // latency histograms
+
+long checked = 0;
+long failed = 0;
+
+// check one condition, report a failure
+void check(int ok, const char *what, uint64_t v) {
+    ++checked;
+    if (!ok) {
+        ++failed;
+        fprintf(stderr, "failed: %s value=%llu index=%u\n", what, (unsigned long long) v, hist_index(v));
+    }
+}
+
+// check the bucket of one value and record it
+void check_value(hist_t *h, uint64_t v) {
+    unsigned int i = hist_index(v);
+
+    check(i < HIST_BUCKETS, "index in range", v);
+    if (i >= HIST_BUCKETS)
+        return;
+    if (v >> HIST_MAX_BITS) {
+        check(i == HIST_BUCKETS - 1, "large value in the last bucket", v);
+    } else {
+        // the bucket covers the value, at most 1 / HIST_SUB above it
+        check(hist_value(i) >= v, "bucket covers the value", v);
+        check(hist_value(i) - v <= v / HIST_SUB, "relative error", v);
+    }
+    hist_record(h, v);
+}
+
+int main(int argc, char *argv[]) {
+    hist_t h;
+    uint64_t v;
+    int bits;
+
+    hist_init(&h);
+    // small exact values
+    for (v = 0; v < 4 * HIST_SUB; ++v)
+        check_value(&h, v);
+    // powers of two and their neighbours over all 64 bits
+    for (bits = 1; bits < 64; ++bits) {
+        check_value(&h, (UINT64_C(1) << bits) - 1);
+        check_value(&h, UINT64_C(1) << bits);
+        check_value(&h, (UINT64_C(1) << bits) + 1);
+    }
+    // values past the largest bucket
+    check_value(&h, UINT64_C(1) << HIST_MAX_BITS);
+    check_value(&h, UINT64_MAX);
+
+    check(h.max == UINT64_MAX, "maximum recorded", h.max);
+    check(hist_percentile(&h, 1.0) == UINT64_MAX, "p100 is the maximum", hist_percentile(&h, 1.0));
+    check(hist_percentile(&h, 0.0) <= hist_percentile(&h, 0.5), "percentiles ordered", hist_percentile(&h, 0.5));
+
+    printf("result checked=%ld failed=%ld\n", checked, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,407 @@
+// Operating Systems: sample code
+// Threads
+// Work-stealing thread pool: many tasks on a few threads
+//
+// A fixed number of worker threads run short tasks (a function and its argument)
+// to completion. Each worker has its own deque (Chase and Lev, "Dynamic circular
+// work-stealing deque", SPAA 2005, with the memory orders of Le et al., PPoPP 2013):
+// the worker pushes and pops the tasks it spawns at the bottom without contention,
+// an idle worker steals from the top of a random victim. Tasks submitted from other
+// threads (and those not fitting into a full deque) go to a shared injection queue.
+// Idle workers sleep on a futex and are woken up by a submission.
+//
+// A task may be added to a wait group; pool_wait() returns once all its tasks are done.
+// A worker waiting for a group runs other tasks meanwhile, so tasks can wait for the
+// tasks they spawn (fork-join). A task must not wait for a task that has not started
+// unless it waits by pool_wait(): a blocked worker does not run anything else.
+//
+// usage:
+//
+// #define _GNU_SOURCE		// syscall(2)
+// #include "thread_pool.h"
+//
+// pool_t pool;
+// pool_wait_t wg = POOL_WAIT_INITIALIZER;
+//
+// pool_init(&pool, workers);
+// pool_submit(&pool, &wg, task, arg);		// task(arg) runs on some worker
+// pool_wait(&pool, &wg);			// all tasks of the group are done
+// pool_destroy(&pool);
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stdio.h>			// perror(3)
+#include <stdlib.h>			// malloc(3), posix_memalign(3)
+#include <string.h>			// memset(3)
+#include <errno.h>
+#include <limits.h>			// INT_MAX
+#include <sched.h>			// sched_yield(2)
+#include <pthread.h>
+#include "futex_lock.h"			// futex_wait(), futex_wake()
+
+// tasks in the deque of one worker, a power of two
+#ifndef POOL_DEQUE_SIZE
+#	define POOL_DEQUE_SIZE	(1<<12)
+#endif
+
+// rounds over all the queues before an idle worker sleeps
+#ifndef POOL_SPIN_LIMIT
+#	define POOL_SPIN_LIMIT	(1<<4)
+#endif
+
+// a group of tasks to wait for
+typedef struct {
+	volatile int count;		// futex: tasks not finished yet
+} pool_wait_t;
+
+#define POOL_WAIT_INITIALIZER	{ 0 }
+
+// a task
+typedef struct {
+	void (*fn)(void *);
+	void *arg;
+	pool_wait_t *wg;		// NULL: no group
+} pool_task_t;
+
+// the deque of one worker: the owner at the bottom, the thieves at the top
+typedef struct {
+	volatile long top __attribute__ ((aligned(64)));
+	volatile long bottom __attribute__ ((aligned(64)));
+	pool_task_t tasks[POOL_DEQUE_SIZE];
+} pool_deque_t;
+
+struct pool;
+
+// a worker, written by its thread only (except the deque)
+typedef struct {
+	pool_deque_t deque;
+	struct pool *pool;
+	int id;
+	pthread_t tid;
+	unsigned long victim;		// xorshift state of the victim choice
+	long executed;			// tasks run by this worker
+	long steals;			// tasks taken from the other workers
+	long spawned;			// tasks pushed to the own deque
+} __attribute__ ((aligned(64))) pool_worker_t;
+
+// pool data
+typedef struct pool {
+	pool_worker_t *workers;
+	int n;
+	// the injection queue: a growing ring protected by the mutex
+	pthread_mutex_t lock;
+	pool_task_t *inject;
+	long head, tail;		// the tasks are head to tail - 1
+	long capacity;
+	volatile long injected;		// tail - head, read without the lock
+	// idle workers
+	volatile int pending __attribute__ ((aligned(64)));	// futex: incremented by a submission to sleepers
+	volatile int sleepers;
+	volatile bool stop;
+} pool_t;
+
+// the worker running the current thread, NULL in other threads
+static __thread pool_worker_t *pool_self;
+
+// start the workers, return 0 or an error number
+static inline
+int pool_init(pool_t *pool, int workers);
+
+// submit the task, add it to the wait group wg (NULL: none)
+static inline
+void pool_submit(pool_t *pool, pool_wait_t *wg, void (*fn)(void *), void *arg);
+
+// wait until all the tasks of the group are done, workers run other tasks meanwhile
+static inline
+void pool_wait(pool_t *pool, pool_wait_t *wg);
+
+// stop the workers, the submitted tasks must be done
+static inline
+void pool_destroy(pool_t *pool);
+
+
+// push a task to the bottom of the own deque, return false if full
+static inline
+bool pool_push(pool_deque_t *dq, const pool_task_t *task)
+{
+	long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= POOL_DEQUE_SIZE)
+		return false;
+	dq->tasks[b & (POOL_DEQUE_SIZE - 1)] = *task;
+	// the task must be visible before the new bottom
+	__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+// pop a task from the bottom of the own deque, return false if empty
+static inline
+bool pool_pop(pool_deque_t *dq, pool_task_t *task)
+{
+	long b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+	long t;
+	bool found = true;
+
+	__atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+	// the new bottom must be visible before top is read: a thief may take the same task
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+	if (t > b) {			// empty
+		__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	*task = dq->tasks[b & (POOL_DEQUE_SIZE - 1)];
+	if (t == b) {			// the last task: race with the thieves
+		found = __atomic_compare_exchange_n(&dq->top, &t, t + 1, false,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+		__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return found;
+}
+
+// steal a task from the top of the deque, return false if empty or lost to another thief
+static inline
+bool pool_steal(pool_deque_t *dq, pool_task_t *task)
+{
+	long t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+	long b;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return false;
+	*task = dq->tasks[t & (POOL_DEQUE_SIZE - 1)];
+	return __atomic_compare_exchange_n(&dq->top, &t, t + 1, false,
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+// add a task to the injection queue, exit if out of memory
+static inline
+void pool_inject(pool_t *pool, const pool_task_t *task)
+{
+	pool_task_t *grown;
+	long i;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail - pool->head == pool->capacity) {
+		// double the ring, the tasks keep their order from index 0
+		if (!(grown = malloc(2 * pool->capacity * sizeof(pool_task_t)))) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		for (i = pool->head; i < pool->tail; ++i)
+			grown[i - pool->head] = pool->inject[i % pool->capacity];
+		free(pool->inject);
+		pool->inject = grown;
+		pool->tail -= pool->head;
+		pool->head = 0;
+		pool->capacity *= 2;
+	}
+	pool->inject[pool->tail++ % pool->capacity] = *task;
+	pool->injected = pool->tail - pool->head;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// take a task from the injection queue, return false if empty
+static inline
+bool pool_take(pool_t *pool, pool_task_t *task)
+{
+	bool found = false;
+
+	if (!pool->injected)
+		return false;
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail > pool->head) {
+		*task = pool->inject[pool->head++ % pool->capacity];
+		pool->injected = pool->tail - pool->head;
+		found = true;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return found;
+}
+
+// find a task: the own deque, the injection queue, then the other workers from a random one
+static inline
+bool pool_find(pool_worker_t *self, pool_task_t *task)
+{
+	pool_t *pool = self->pool;
+	int i, victim;
+
+	if (pool_pop(&self->deque, task) || pool_take(pool, task))
+		return true;
+	self->victim ^= self->victim << 13;
+	self->victim ^= self->victim >> 7;
+	self->victim ^= self->victim << 17;
+	for (i = 0; i < pool->n; ++i) {
+		victim = (self->victim + i) % pool->n;
+		if (victim != self->id && pool_steal(&pool->workers[victim].deque, task)) {
+			++self->steals;
+			return true;
+		}
+	}
+	return false;
+}
+
+// a task of the group is done
+static inline
+void pool_done(pool_wait_t *wg)
+{
+	// the waiter may return and reuse the group as soon as the count is 0: no access after it,
+	// futex_wake(2) only uses the address
+	if (__atomic_sub_fetch(&wg->count, 1, __ATOMIC_SEQ_CST) == 0)
+		futex_wake(&wg->count, INT_MAX);
+}
+
+// run the task and report it done
+static inline
+void pool_run(pool_worker_t *self, const pool_task_t *task)
+{
+	task->fn(task->arg);
+	++self->executed;
+	if (task->wg)
+		pool_done(task->wg);
+}
+
+// wake up a sleeping worker after a task was published
+static inline
+void pool_signal(pool_t *pool)
+{
+	// the task must be visible before the sleepers are checked (against pool_idle())
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->sleepers, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&pool->pending, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&pool->pending, 1);
+	}
+}
+
+// sleep until a task is submitted, return at once if there is one
+static inline
+void pool_idle(pool_worker_t *self)
+{
+	pool_t *pool = self->pool;
+	pool_task_t task;
+	int pending;
+
+	__atomic_fetch_add(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	pending = __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST);
+	// a submission now either sees the sleeper or is seen here
+	if (pool_find(self, &task)) {
+		__atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+		pool_run(self, &task);
+		return;
+	}
+	if (!__atomic_load_n(&pool->stop, __ATOMIC_SEQ_CST))
+		futex_wait(&pool->pending, pending);
+	__atomic_fetch_sub(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+// the worker thread
+static inline
+void *pool_worker(void *arg)
+{
+	pool_worker_t *self = arg;
+	pool_task_t task;
+	unsigned int spins = 0;
+
+	pool_self = self;
+	while (!__atomic_load_n(&self->pool->stop, __ATOMIC_ACQUIRE)) {
+		if (pool_find(self, &task)) {
+			pool_run(self, &task);
+			spins = 0;
+		} else if (++spins < POOL_SPIN_LIMIT) {
+			sched_yield();		// a task may come soon
+		} else {
+			pool_idle(self);
+			spins = 0;
+		}
+	}
+	return NULL;
+}
+
+// start the workers
+int pool_init(pool_t *pool, int workers)
+{
+	int rc;
+	int i;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->capacity = POOL_DEQUE_SIZE;
+	if (posix_memalign((void **) &pool->workers, 64, workers * sizeof(pool_worker_t)))
+		return ENOMEM;
+	if (!(pool->inject = malloc(pool->capacity * sizeof(pool_task_t)))) {
+		free(pool->workers);
+		return ENOMEM;
+	}
+	memset(pool->workers, 0, workers * sizeof(pool_worker_t));
+	if ((rc = pthread_mutex_init(&pool->lock, NULL)))
+		return rc;
+	for (i = 0; i < workers; ++i) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		pool->workers[i].victim = 0x9E3779B97F4A7C15UL * (i + 1);	// xorshift: not 0
+	}
+	// the pool is complete before any worker runs
+	for (pool->n = 0; pool->n < workers; ++pool->n)
+		if ((rc = pthread_create(&pool->workers[pool->n].tid, NULL, pool_worker, &pool->workers[pool->n]))) {
+			pool_destroy(pool);
+			return rc;
+		}
+	return 0;
+}
+
+// submit the task: to the own deque on a worker of the pool, to the injection queue otherwise
+void pool_submit(pool_t *pool, pool_wait_t *wg, void (*fn)(void *), void *arg)
+{
+	pool_task_t task = { fn, arg, wg };
+
+	if (wg)
+		__atomic_fetch_add(&wg->count, 1, __ATOMIC_RELAXED);
+	if (pool_self && pool_self->pool == pool && pool_push(&pool_self->deque, &task))
+		++pool_self->spawned;
+	else
+		pool_inject(pool, &task);
+	pool_signal(pool);
+}
+
+// wait for the group
+void pool_wait(pool_t *pool, pool_wait_t *wg)
+{
+	pool_task_t task;
+	int count;
+
+	// a worker helps: runs the tasks, possibly those of the group
+	if (pool_self && pool_self->pool == pool) {
+		while (__atomic_load_n(&wg->count, __ATOMIC_ACQUIRE))
+			if (pool_find(pool_self, &task))
+				pool_run(pool_self, &task);
+			else
+				sched_yield();		// the rest of the group is running elsewhere
+		return;
+	}
+	// another thread sleeps until the last task of the group wakes it up
+	while ((count = __atomic_load_n(&wg->count, __ATOMIC_ACQUIRE)))
+		futex_wait(&wg->count, count);
+}
+
+// stop and join the workers
+void pool_destroy(pool_t *pool)
+{
+	int i;
+
+	__atomic_store_n(&pool->stop, true, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&pool->pending, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&pool->pending, INT_MAX);
+	for (i = 0; i < pool->n; ++i)
+		pthread_join(pool->workers[i].tid, NULL);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool->inject);
+	pool->workers = NULL;
+	pool->inject = NULL;
+}
+
+#endif // THREAD_POOL_H
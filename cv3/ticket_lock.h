@@ -0,0 +1,88 @@
+// Operating Systems: sample code
+// Critical Sections
+// HW method: ticket lock (fetch-and-add)
+//
+// A thread takes the next ticket with an atomic fetch-and-add and waits until
+// the owner counter reaches its ticket. The lock is granted in FIFO order,
+// no thread can be overtaken (starved) by the others.
+// If the threads outnumber the CPUs, the next thread in the line may not be running:
+// when the owner does not change for TICKET_SPIN_LIMIT pause instructions,
+// the waiting thread gives up the CPU.
+//
+// usage:
+//
+// #include "ticket_lock.h"
+//
+// ticket_lock_t lock = TICKET_LOCK_INITIALIZER;
+//
+// ticket_lock(&lock);
+// // critical section
+// ticket_unlock(&lock);
+
+#ifndef TICKET_LOCK_H
+#define TICKET_LOCK_H
+
+#include <stdbool.h>
+#include <sched.h>			// sched_yield(2)
+#include "test_and_set_bool.h"		// cpu_relax()
+
+// ticket lock data
+typedef struct {
+	volatile unsigned int next;	// the next ticket to be taken
+	volatile unsigned int owner;	// the ticket currently allowed into the critical section
+} ticket_lock_t;
+
+#define TICKET_LOCK_INITIALIZER	{ 0, 0 }
+
+// pause instructions per waiting thread ahead of us (proportional backoff)
+#ifndef TICKET_BACKOFF
+#	define TICKET_BACKOFF	(1<<3)
+#endif
+
+// pause instructions without progress before the CPU is given up
+#ifndef TICKET_SPIN_LIMIT
+#	define TICKET_SPIN_LIMIT	(1<<7)
+#endif
+
+// acquire the lock
+__attribute__ ((always_inline)) static inline
+void ticket_lock(ticket_lock_t *lock);
+
+// release the lock
+__attribute__ ((always_inline)) static inline
+void ticket_unlock(ticket_lock_t *lock);
+
+
+// acquire the lock
+void ticket_lock(ticket_lock_t *lock)
+{
+	// take a ticket: atomic fetch-and-add (lock xadd)
+	unsigned int ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+	unsigned int ahead, last = 0;
+	unsigned int spins = 0;
+	unsigned int i;
+
+	// wait for our turn, the longer the queue the longer between the reads of owner
+	while ((ahead = ticket - __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE))) {
+		if (ahead != last) {		// the queue moves
+			last = ahead;
+			spins = 0;
+		} else if (spins >= TICKET_SPIN_LIMIT) {
+			spins = 0;
+			sched_yield();	// the owner is probably preempted: let it run
+			continue;
+		}
+		for (i = 0; i < ahead * TICKET_BACKOFF; ++i)
+			cpu_relax();
+		spins += i;
+	}
+}
+
+// release the lock
+void ticket_unlock(ticket_lock_t *lock)
+{
+	// only the owner writes to owner: no atomic read-modify-write is needed
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+#endif // TICKET_LOCK_H
@@ -0,0 +1,67 @@
+// Operating Systems: sample code
+// Critical Sections
+// HW method: test-and-test-and-set with exponential backoff
+//
+// The waiting thread spins on a plain load (the cache line stays shared in the caches
+// of all waiting CPUs) and tries the locked xchg only when the lock looks free.
+// After a failed test_and_set() it backs off for a bounded, exponentially growing
+// number of pause instructions, so the waiters do not retry all at once.
+//
+// usage:
+//
+// #include <stdbool.h>
+// #include "ttas_lock.h"
+//
+// volatile bool locked = false;
+//
+// ttas_lock(&locked);
+// // critical section
+// ttas_unlock(&locked);
+
+#ifndef TTAS_LOCK_H
+#define TTAS_LOCK_H
+
+#include "test_and_set_bool.h"		// test_and_set(), release_lock(), cpu_relax()
+
+// backoff bounds (the number of pause instructions), may be overridden with -D
+#ifndef TTAS_BACKOFF_MIN
+#	define TTAS_BACKOFF_MIN	(1<<2)
+#endif
+#ifndef TTAS_BACKOFF_MAX
+#	define TTAS_BACKOFF_MAX	(1<<10)
+#endif
+
+// acquire the lock
+__attribute__ ((always_inline)) static inline
+void ttas_lock(volatile bool *locked);
+
+// release the lock
+__attribute__ ((always_inline)) static inline
+void ttas_unlock(volatile bool *locked);
+
+
+// acquire the lock
+void ttas_lock(volatile bool *locked)
+{
+	unsigned int backoff = TTAS_BACKOFF_MIN;
+	unsigned int i;
+
+	for (;;) {
+		while (*locked)			// test: read only, no bus locking
+			cpu_relax();
+		if (!test_and_set(locked))	// test-and-set: the lock was free, now it is ours
+			return;
+		for (i = 0; i < backoff; ++i)	// somebody was faster: back off
+			cpu_relax();
+		if (backoff < TTAS_BACKOFF_MAX)
+			backoff <<= 1;
+	}
+}
+
+// release the lock
+void ttas_unlock(volatile bool *locked)
+{
+	release_lock(locked);
+}
+
+#endif // TTAS_LOCK_H
@@ -0,0 +1,268 @@
+// Operating Systems: sample code
+// Threads
+// Bank workload generator: operation mix, Zipfian account skew, amount distributions
+//
+// Each operation is a deposit, a withdrawal, an inquiry or a transfer, chosen by the
+// mix of percentages. The accounts follow the Zipfian distribution with the skew
+// theta (0: uniform, 0.99: a few very hot accounts), generated by the method of Gray
+// et al. ("Quickly generating billion-record synthetic databases", SIGMOD 1994).
+// The popularity rank is scrambled to an account number, so the hot accounts are
+// spread over the array instead of sharing a cache line.
+// The amounts are uniform (1 to max), exponential (mean max / 4, at most max)
+// or fixed (always max).
+//
+// A generated stream can be written to a text file and read back, so a run can be
+// replayed exactly. The file has a header line and one operation per line:
+//   workload threads=T ops=N accounts=A
+//   <thread> <d|w|i|t> <account> <to account> <amount>
+//
+// usage:
+//
+// #include "workload.h"
+//
+// workload_t w = WORKLOAD_DEFAULTS;
+//
+// workload_parse_mix("20:40:30:10", w.mix);	// deposit:withdraw:inquiry:transfer
+// w.accounts = 1<<16; w.theta = 0.99;
+// workload_init(&w);
+// workload_next(&w, &rng, &op);		// rng: a per-thread rng_t
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>			// strtol(3)
+#include <string.h>
+#include <limits.h>			// INT_MAX
+#include <math.h>			// pow(3), log(3), link with -lm
+#include "rng.h"
+
+// operation types
+typedef enum {
+	OP_DEPOSIT,
+	OP_WITHDRAW,
+	OP_INQUIRY,
+	OP_TRANSFER,
+	OP_TYPES			// the number of types
+} op_type_t;
+
+static const char op_codes[OP_TYPES] = { 'd', 'w', 'i', 't' };
+
+static const char *op_names[OP_TYPES] __attribute__ ((unused)) = {
+	[OP_DEPOSIT]	= "deposits",
+	[OP_WITHDRAW]	= "withdrawals",
+	[OP_INQUIRY]	= "inquiries",
+	[OP_TRANSFER]	= "transfers",
+};
+
+// amount distributions
+typedef enum {
+	AMOUNT_UNIFORM,
+	AMOUNT_EXP,
+	AMOUNT_FIXED,
+	AMOUNT_DISTS			// the number of distributions
+} amount_dist_t;
+
+static const char *amount_dist_names[AMOUNT_DISTS] __attribute__ ((unused)) = {
+	[AMOUNT_UNIFORM]	= "uniform",
+	[AMOUNT_EXP]		= "exp",
+	[AMOUNT_FIXED]		= "fixed",
+};
+
+// one operation, 16 bytes
+typedef struct {
+	int type;			// op_type_t
+	int amount;
+	int account;			// the account, the source of a transfer
+	int to;				// the destination of a transfer
+} workload_op_t;
+
+// workload parameters and the precomputed Zipfian constants
+typedef struct {
+	int mix[OP_TYPES];		// percentages, the sum is 100
+	long accounts;			// at least 2
+	double theta;			// Zipfian skew, 0 <= theta < 1, 0: uniform
+	amount_dist_t dist;
+	int max_amount;
+	// computed by workload_init()
+	double zetan;			// zeta(accounts, theta)
+	double alpha, eta;
+	double half_pow_theta;		// 0.5^theta
+	unsigned long scramble;		// rank to account multiplier, coprime to accounts
+} workload_t;
+
+#define WORKLOAD_DEFAULTS	{ { 0, 0, 0, 100 }, 1<<16, 0.0, AMOUNT_UNIFORM, 1<<6, 0, 0, 0, 0, 1 }
+
+
+// parse the mix "deposit:withdraw:inquiry:transfer", return 0 or -1 if invalid
+static inline
+int workload_parse_mix(const char *s, int *mix)
+{
+	char *end;
+	int sum = 0;
+	int i;
+
+	for (i = 0; i < OP_TYPES; ++i) {
+		mix[i] = strtol(s, &end, 10);
+		if (end == s || mix[i] < 0 || (i < OP_TYPES - 1 ? *end != ':' : *end != '\0'))
+			return -1;
+		sum += mix[i];
+		s = end + 1;
+	}
+	return sum == 100 ? 0 : -1;
+}
+
+// greatest common divisor
+static inline
+unsigned long workload_gcd(unsigned long a, unsigned long b)
+{
+	unsigned long t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// precompute the Zipfian constants, O(accounts), return 0 or -1 if the parameters are invalid
+static inline
+int workload_init(workload_t *w)
+{
+	double zeta2;
+	long i;
+
+	if (w->accounts < 2 || w->accounts > INT_MAX || w->theta < 0 || w->theta >= 1 || w->max_amount < 1)
+		return -1;
+	w->zetan = 0;
+	for (i = 1; i <= w->accounts; ++i)
+		w->zetan += 1 / pow(i, w->theta);
+	zeta2 = 1 + 1 / pow(2, w->theta);
+	w->alpha = 1 / (1 - w->theta);
+	w->eta = (1 - pow(2.0 / w->accounts, 1 - w->theta)) / (1 - zeta2 / w->zetan);
+	w->half_pow_theta = pow(0.5, w->theta);
+
+	// the golden ratio multiplier, made coprime to the number of accounts: a permutation
+	w->scramble = 0x9E3779B97F4A7C15UL % w->accounts;
+	while (workload_gcd(w->scramble, w->accounts) != 1)	// gcd(0, n) = n, gcd(1, n) = 1
+		w->scramble = (w->scramble + 1) % w->accounts;
+	return 0;
+}
+
+// uniform number in [0, 1)
+static inline
+double workload_uniform(rng_t *rng)
+{
+	return (rng_next(rng) >> 11) * (1.0 / (1ULL << 53));
+}
+
+// random account, Zipfian
+static inline
+long workload_account(const workload_t *w, rng_t *rng)
+{
+	double u, uz;
+	long rank;
+
+	if (w->theta == 0)
+		return rng_below(rng, w->accounts);
+	u = workload_uniform(rng);
+	uz = u * w->zetan;
+	if (uz < 1)
+		rank = 0;
+	else if (uz < 1 + w->half_pow_theta)
+		rank = 1;
+	else
+		rank = (long) (w->accounts * pow(w->eta * u - w->eta + 1, w->alpha));
+	if (rank >= w->accounts)
+		rank = w->accounts - 1;
+	return (unsigned long) rank * w->scramble % w->accounts;
+}
+
+// random amount: 1 to max_amount
+static inline
+int workload_amount(const workload_t *w, rng_t *rng)
+{
+	double amount;
+
+	switch (w->dist) {
+	case AMOUNT_EXP:
+		amount = 1 - log(1 - workload_uniform(rng)) * w->max_amount / 4;
+		return amount < w->max_amount ? (int) amount : w->max_amount;
+	case AMOUNT_FIXED:
+		return w->max_amount;
+	default:
+		return 1 + rng_below(rng, w->max_amount);
+	}
+}
+
+// generate the next operation
+static inline
+void workload_next(const workload_t *w, rng_t *rng, workload_op_t *op)
+{
+	int p = rng_below(rng, 100);
+	int t;
+
+	for (t = 0; t < OP_TYPES - 1 && p >= w->mix[t]; ++t)
+		p -= w->mix[t];
+	op->type = t;
+	op->account = workload_account(w, rng);
+	op->to = op->account;
+	if (t == OP_TRANSFER)
+		while (op->to == op->account)	// two different accounts
+			op->to = workload_account(w, rng);
+	op->amount = t == OP_INQUIRY ? 0 : workload_amount(w, rng);
+}
+
+// write the streams ops[thread][0 .. n - 1] of all threads, return 0 or -1 on error
+static inline
+int workload_write(FILE *f, workload_op_t **ops, int threads, long n, long accounts)
+{
+	const workload_op_t *op;
+	int t;
+	long i;
+
+	fprintf(f, "workload threads=%d ops=%ld accounts=%ld\n", threads, n, accounts);
+	for (t = 0; t < threads; ++t)
+		for (i = 0; i < n; ++i) {
+			op = &ops[t][i];
+			fprintf(f, "%d %c %d %d %d\n", t, op_codes[op->type], op->account, op->to, op->amount);
+		}
+	return ferror(f) ? -1 : 0;
+}
+
+// read the header of a stream file, return 0 or -1 on error
+static inline
+int workload_read_header(FILE *f, int *threads, long *n, long *accounts)
+{
+	if (fscanf(f, "workload threads=%d ops=%ld accounts=%ld\n", threads, n, accounts) != 3
+	    || *threads < 1 || *n < 1 || *accounts < 2)
+		return -1;
+	return 0;
+}
+
+// read the streams into ops[thread][0 .. n - 1] after the header, return 0 or -1 on error;
+// the lines must be ordered by the thread as workload_write() writes them
+static inline
+int workload_read(FILE *f, workload_op_t **ops, int threads, long n, long accounts)
+{
+	workload_op_t *op;
+	char code;
+	const char *type;
+	int t, thread;
+	long i;
+
+	for (t = 0; t < threads; ++t)
+		for (i = 0; i < n; ++i) {
+			op = &ops[t][i];
+			if (fscanf(f, "%d %c %d %d %d\n", &thread, &code, &op->account, &op->to, &op->amount) != 5
+			    || thread != t || !(type = memchr(op_codes, code, OP_TYPES))
+			    || op->account < 0 || op->account >= accounts || op->to < 0 || op->to >= accounts
+			    || op->amount < 0)
+				return -1;
+			op->type = type - op_codes;
+		}
+	return 0;
+}
+
+#endif // WORKLOAD_H
@@ -7,13 +7,16 @@
 #include <errno.h>
 #include <pthread.h>
 #include "pthread_sem.h"	// pthread semaphores
+#include "../cv3/latency_hist.h"	// latency histograms, TSC timestamps
+#include "../cv3/thread_pool.h"	// work-stealing thread pool
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>		// getopt
 
-#define THREADS		8
+#define THREADS		8	// logical threads: tasks of the pool
 #define THREADS_IN_CS	3
+#define WORKERS		4	// OS threads of the pool, more than THREADS_IN_CS
 
 // print binary
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
@@ -30,19 +33,25 @@
 unsigned int bit_field;
 
 pt_sem_t pt_sem;		// semaphore
+pool_t pool;			// the workers running the threads
+
+hist_t wait_hist[THREADS];	// pt_sem_wait latency of each thread
 
 void pt_sem_cleanup() {
 	if (pt_sem_destroy(&pt_sem))
 		perror("pt_sem_destroy");
 }
 
-void *thread_CS(void *arg)
+void thread_CS(void *arg)
 {
 	int id = *(int *)arg;
 	int i;
+	uint64_t t;
 
 	for (i = 0; i < 3; ++i) {
+		t = tsc_read();
 		pt_sem_wait(&pt_sem);
+		hist_record(&wait_hist[id], tsc_read() - t);
 		bit_field |= 1 << id;		// set my bit
 		printf("%2d: Inside CS: 0x%02X " BYTE_TO_BINARY_PATTERN "\n",
 			id, bit_field, BYTE_TO_BINARY(bit_field));
@@ -50,7 +59,6 @@ void *thread_CS(void *arg)
 		bit_field &= ~(1 << id);	// clear my bit
 		pt_sem_post(&pt_sem);
 	}
-	return NULL;
 }
 
 
@@ -60,11 +68,10 @@ void *thread_CS(void *arg)
 int main(int argc, char *argv[])
 {
 	int i;
-	// structure array for threads / pole záznamů pro vlákna
-	struct thread_info_t {
-		pthread_t id;
-		int arg;
-	} thread_info[THREADS];
+	double ns_per_tick = tsc_ns_per_tick();
+	hist_t total;
+	int thread_arg[THREADS];	// arguments of the threads / argumenty vláken
+	pool_wait_t wg = POOL_WAIT_INITIALIZER;
 
 	// init for the critical section access control
 	if (pt_sem_init(&pt_sem, THREADS_IN_CS)) {
@@ -73,21 +80,34 @@ int main(int argc, char *argv[])
 	}
 	atexit(pt_sem_cleanup);
 
+	// the workers run the threads as tasks
+	if ((errno = pool_init(&pool, WORKERS))) {
+		perror("pool_init");
+		exit(EXIT_FAILURE);
+	}
+
 	// start several threads performing transactions
 	for (i = 0; i < THREADS; ++i) {
-		thread_info[i].arg = i;
-		if (pthread_create(&thread_info[i].id, NULL, thread_CS,
-				   &thread_info[i].arg)) {
-			// failed to create a thread
-			perror("pthread_create");
-			return 1;
-		}
+		hist_init(&wait_hist[i]);
+		thread_arg[i] = i;
+		pool_submit(&pool, &wg, thread_CS, &thread_arg[i]);
 	}
 
 	// wait for threads to finish / čekej na dokončení vláken
+	pool_wait(&pool, &wg);
+	pool_destroy(&pool);
+
+	// report the pt_sem_wait latency of each thread and overall
+	hist_init(&total);
 	for (i = 0; i < THREADS; ++i) {
-		pthread_join(thread_info[i].id, NULL);
+		printf("%2d: pt_sem_wait:", i);
+		hist_print("wait", &wait_hist[i], ns_per_tick);
+		putchar('\n');
+		hist_merge(&total, &wait_hist[i]);
 	}
+	printf("all pt_sem_wait:");
+	hist_print("wait", &total, ns_per_tick);
+	putchar('\n');
 
 	return 0;
 }
@@ -14,8 +14,10 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
+#include "../cv3/thread_pool.h"	// work-stealing thread pool
 
 #define ITERATIONS 1000000	// the number of operations
+#define THREADS 2		// tasks incrementing the count, each on its own worker
 
 volatile int count = 0;		// shared variable
 
@@ -50,7 +52,7 @@ static void sync_threads(void)
 	}
 }
 
-void *ThreadAdd(void *arg)
+void ThreadAdd(void *arg)
 {
 	int i;
 
@@ -90,12 +92,13 @@ void *ThreadAdd(void *arg)
         // (post)
         semop(sID, &sops, 1);
     }
-	return NULL;
 }
 
 int main(int argc, char *argv[])
 {
-	pthread_t tid1, tid2;
+	pool_t pool;
+	pool_wait_t wg = POOL_WAIT_INITIALIZER;
+	int i;
 
 	atexit(release_resources);	// release resources at program exit
 
@@ -128,32 +131,24 @@ int main(int argc, char *argv[])
 
     sem_initialized = true;
 
-	// create two threads
-	if (pthread_create(&tid1, NULL, ThreadAdd, NULL)) {
-		fprintf(stderr, "ERROR creating thread 1\n");
-		return EXIT_FAILURE;
-	}
-	if (pthread_create(&tid2, NULL, ThreadAdd, NULL)) {
-		fprintf(stderr, "ERROR creating thread 2\n");
+	// run the two tasks on a pool of two workers
+	if ((errno = pool_init(&pool, THREADS))) {
+		perror("pool_init");
 		return EXIT_FAILURE;
 	}
+	for (i = 0; i < THREADS; ++i)
+		pool_submit(&pool, &wg, ThreadAdd, NULL);
 
-	// wait for the threads termination
-	if (pthread_join(tid1, NULL)) {
-		fprintf(stderr, "ERROR joining thread 1\n");
-		return EXIT_FAILURE;
-	}
-	if (pthread_join(tid2, NULL)) {
-		fprintf(stderr, "ERROR joining thread 2\n");
-		return EXIT_FAILURE;
-	}
+	// wait for the tasks termination
+	pool_wait(&pool, &wg);
+	pool_destroy(&pool);
 
 	// resources are released using atexit(3)
 
 	// check the result
-	if (count < 2 * ITERATIONS) {
+	if (count < THREADS * ITERATIONS) {
 		fprintf(stderr, "BOOM! count is %d, should be %d\n", count,
-			2 * ITERATIONS);
+			THREADS * ITERATIONS);
 		return EXIT_FAILURE;
 	}
 	else {